@@ -1,59 +1,199 @@
 import matplotlib.pyplot as plt
-from scipy.interpolate import griddata  # Correct import
-import pandas as pd
 import numpy as np
-import os
+import struct
 import sys
-import tomllib
 
 
-def parse_header(file):
-    with open(file, "r") as f:
-        for line in f:
-            if line.startswith("#"):
-                header = line
-            else:
+SNAPSHOT_HEADER = struct.Struct("<8sQQQ")
+DENSITY_HEADER = struct.Struct("<8sQQQQ")
+STREAM_HEADER = struct.Struct("<8sQQQQQ")
+CHUNK_HEADER = struct.Struct("<QQQQQ")
+INDEX_ENTRY = struct.Struct("<QQQQ")
+
+
+def read_snapshots(file):
+    """
+    Read all frames of a snapshot file written by mpi_gol. Each frame is a
+    header (magic, grid size, step, bytes per row) followed by the grid with
+    one bit per cell. Yields (step, grid) pairs.
+    """
+    with open(file, "rb") as f:
+        while True:
+            header = f.read(SNAPSHOT_HEADER.size)
+            if len(header) < SNAPSHOT_HEADER.size:
+                break
+
+            magic, grid_size, step, row_bytes = SNAPSHOT_HEADER.unpack(header)
+
+            if magic != b"GOLSNAP1":
+                raise ValueError(f"{file} is not a mpi_gol snapshot file")
+
+            packed = np.frombuffer(f.read(grid_size * row_bytes), dtype=np.uint8)
+            packed = packed.reshape(grid_size, row_bytes)
+            grid = np.unpackbits(packed, axis=1, bitorder="little")
+
+            yield step, grid[:, :grid_size]
+
+
+def read_density(file):
+    """
+    Read all frames of a density map file written by mpi_gol. Each frame is a
+    header (magic, grid size, step, block size, map size) followed by the
+    fraction of live cells of every block, as floats. Yields (step, map)
+    pairs.
+    """
+    with open(file, "rb") as f:
+        while True:
+            header = f.read(DENSITY_HEADER.size)
+            if len(header) < DENSITY_HEADER.size:
+                break
+
+            magic, grid_size, step, block, map_size = DENSITY_HEADER.unpack(header)
+
+            if magic != b"GOLDENS1":
+                raise ValueError(f"{file} is not a mpi_gol density map file")
+
+            values = np.frombuffer(f.read(4 * map_size * map_size), dtype="<f4")
+
+            yield step, values.reshape(map_size, map_size)
+
+
+def decode_zero_runs(data, size):
+    """
+    Decode `size` bytes stored as (zero bytes, literal bytes) pairs of LEB128
+    varints, each pair followed by its literal bytes.
+    """
+    out = bytearray(size)
+    pos = 0
+    i = 0
+
+    def varint():
+        nonlocal i
+        value = 0
+        shift = 0
+        while True:
+            byte = data[i]
+            i += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if byte < 0x80:
+                return value
+
+    while pos < size:
+        pos += varint()
+        literals = varint()
+        out[pos:pos + literals] = data[i:i + literals]
+        pos += literals
+        i += literals
+
+    return np.frombuffer(bytes(out), dtype=np.uint8)
+
+
+def read_stream_frame(f, offset, grid):
+    """
+    Apply the frame of a delta stream that starts at `offset` to `grid`:
+    keyframes overwrite the blocks of their chunks, deltas flip the cells that
+    changed. Returns the step of the frame and the size of the frame.
+    """
+    f.seek(offset)
+    magic, grid_size, step, keyframe, chunks, size = STREAM_HEADER.unpack(
+        f.read(STREAM_HEADER.size))
+
+    if magic != b"GOLDLTA1":
+        raise ValueError("not a mpi_gol delta stream frame")
+
+    for _ in range(chunks):
+        row_offset, rows, col_offset, cols, encoded = CHUNK_HEADER.unpack(
+            f.read(CHUNK_HEADER.size))
+
+        row_bytes = (cols + 7) // 8
+        packed = decode_zero_runs(f.read(encoded), rows * row_bytes)
+        block = np.unpackbits(packed.reshape(rows, row_bytes), axis=1,
+                              bitorder="little")[:, :cols]
+
+        target = grid[row_offset:row_offset + rows, col_offset:col_offset + cols]
+        if keyframe:
+            target[:] = block
+        else:
+            target ^= block
+
+    return step, size
+
+
+def read_stream(file):
+    """
+    Read all frames of a delta stream written by mpi_gol, from the first
+    keyframe on. Yields (step, grid) pairs.
+    """
+    with open(file, "rb") as f:
+        f.seek(0, 2)
+        end = f.tell()
+
+        offset = 0
+        grid = None
+
+        while offset < end:
+            f.seek(offset + 8)
+            grid_size = struct.unpack("<Q", f.read(8))[0]
+
+            if grid is None:
+                grid = np.zeros((grid_size, grid_size), dtype=np.uint8)
+
+            step, size = read_stream_frame(f, offset, grid)
+            offset += size
+
+            yield step, grid.copy()
+
+
+def read_generation(file, index_file, step):
+    """
+    Grid of generation `step` in a delta stream, through its index: start at
+    the last keyframe before the frame of `step` and apply the deltas after it.
+    """
+    entries = []
+    with open(index_file, "rb") as f:
+        while True:
+            entry = f.read(INDEX_ENTRY.size)
+            if len(entry) < INDEX_ENTRY.size:
                 break
 
-    return header[1:].strip().split()
+            entries.append(INDEX_ENTRY.unpack(entry))
+
+    target = next((k for k, e in enumerate(entries) if e[0] == step), None)
+    if target is None:
+        raise ValueError(f"generation {step} is not in {file}")
+
+    first = max(k for k in range(target + 1) if entries[k][3] == 1)
+
+    with open(file, "rb") as f:
+        f.seek(8)
+        grid_size = struct.unpack("<Q", f.read(8))[0]
+        grid = np.zeros((grid_size, grid_size), dtype=np.uint8)
 
+        for k in range(first, target + 1):
+            read_stream_frame(f, entries[k][1], grid)
 
-def read_tsv(file, read_header=True):
-    basename = os.path.basename(file)
-    name, _ = os.path.splitext(basename)
+    return grid
 
-    if read_header:
-        header = parse_header(file)
-    else:
-        header = None
 
-    if read_header:
-        df = pd.read_csv(
-            file,
-            sep="\\s+",
-            comment="#",
-            names=header
-        )
-    else:
-        df = pd.read_csv(
-            file,
-            sep="\\s+",
-            header=None
-        )
+def read_frames(file):
+    """
+    Frames of either kind of file, told apart by the magic of the first one
+    """
+    with open(file, "rb") as f:
+        magic = f.read(8)
 
-    return (name, header, df)
+    if magic == b"GOLDENS1":
+        return read_density(file)
 
+    if magic == b"GOLDLTA1":
+        return read_stream(file)
 
-def plot_grid(ax, df, step):
-    x = df["1:row"].to_numpy()
-    y = df["2:col"].to_numpy()
-    z = df["3:state"].to_numpy()
+    return read_snapshots(file)
 
-    width = x.max() + 1
-    height = y.max() + 1
 
-    image = np.zeros((width, height), dtype=int)
-    image[x, y] = z
+def plot_grid(ax, image, step):
+    width, height = image.shape
 
     ax.imshow(image, cmap="viridis", origin="upper")
 
@@ -70,33 +210,17 @@ def plot_grid(ax, df, step):
 
 
 if __name__ == "__main__":
-    if len(sys.argv) != 3:
-        print(f"Usage: {sys.argv[0]} <config-file.toml> <num-mpi-procs>")
+    if len(sys.argv) != 2:
+        print(f"Usage: {sys.argv[0]} <snapshot-density-or-stream-file>")
         exit()
 
-    with open(sys.argv[1], "rb") as f:
-        toml_file = tomllib.load(f)
-        iterations = int(toml_file["general"]["generations"])
-        ranks = int(sys.argv[2])
-
-    for it in range(0, iterations):
+    for it, grid in read_frames(sys.argv[1]):
         plt.close("all")
         plt.title(f"Conway's Game of Life - Iteration {it}")
 
         fig, ax = plt.subplots(1)
 
-        dfs = []
-
-        for rank in range(0, ranks):
-            file_in = f"gol_it_{it:08}_rank_{rank:08}.dat"
-
-            name, header, df = read_tsv(file_in)
-            dfs.append(df)
-
-        merged_df = pd.concat(dfs)
-        sorted_df = merged_df.sort_values("1:row", ascending=True)
-
-        plot_grid(ax, sorted_df, it)
+        plot_grid(ax, grid, it)
 
         file_out = f"gol_it_{it:08}.png"
         fig.tight_layout()
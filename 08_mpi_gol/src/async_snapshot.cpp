@@ -0,0 +1,234 @@
+#include "async_snapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+/*
+ * File type of our part of every frame: the header on rank 0, then our block of the grid, with an
+ * extent of a whole frame so that it repeats once per frame.
+ */
+static auto make_frame_type(usize grid_size, const Partition &p, bool header) -> MPI_Datatype {
+  auto block_type = make_block_type(grid_size, p);
+
+  const int lengths[2] = {sizeof(SnapshotHeader), 1};
+  const MPI_Aint displacements[2] = {0, sizeof(SnapshotHeader)};
+  const MPI_Datatype types[2] = {MPI_BYTE, block_type};
+  const int first = header ? 0 : 1;
+
+  MPI_Datatype part_type = MPI_DATATYPE_NULL;
+  MPI_Type_create_struct(2 - first, lengths + first, displacements + first, types + first,
+                         &part_type);
+
+  MPI_Datatype frame_type = MPI_DATATYPE_NULL;
+  MPI_Type_create_resized(part_type, 0, static_cast<MPI_Aint>(frame_bytes(grid_size)),
+                          &frame_type);
+  MPI_Type_commit(&frame_type);
+
+  MPI_Type_free(&part_type);
+  MPI_Type_free(&block_type);
+
+  return frame_type;
+}
+
+// Make our part of every frame the view of the file
+static void set_frame_view(AsyncSnapshotWriter &writer, const Partition &p) {
+  if (writer.frame_type != MPI_DATATYPE_NULL) {
+    MPI_Type_free(&writer.frame_type);
+  }
+
+  writer.frame_type = make_frame_type(writer.grid_size, p, writer.rank == 0);
+  writer.part_bytes = p.local_rows * packed_row_bytes(p.local_cols)
+                      + (writer.rank == 0 ? sizeof(SnapshotHeader) : 0);
+
+  keep_error(writer.error, MPI_File_set_view(writer.file, 0, MPI_BYTE, writer.frame_type,
+                                             "native", MPI_INFO_NULL));
+}
+
+/*
+ * Release the staging buffer of the oldest frame in flight once its write completes. OpenMPI 4.1
+ * crashes in MPI_Wait and MPI_Test when a file request fails, as it looks for the error handler of
+ * a file the request does not know. So we poll the request with MPI_Request_get_status, which
+ * leaves the error in the status, and free it ourselves.
+ */
+static auto retire_frame(AsyncSnapshotWriter &writer, bool wait) -> bool {
+  auto &frame = writer.slots[writer.head];
+
+  MPI_Status status{};
+  int done = 0;
+
+  do {
+    MPI_Request_get_status(frame.request, &done, &status);
+  } while (wait && done == 0);
+
+  if (done == 0) {
+    return false;
+  }
+
+  /*
+   * A write that failed to start has no request, and its error is already kept. The error of a
+   * failed request is whatever code the MPI-IO layer left there, so we report it as MPI_ERR_IO.
+   */
+  if (frame.request != MPI_REQUEST_NULL) {
+    MPI_Request_free(&frame.request);
+
+    const auto result = (status.MPI_ERROR == MPI_SUCCESS) ? MPI_SUCCESS : MPI_ERR_IO;
+    keep_error(writer.error, write_result(result, status, MPI_BYTE, frame.bytes));
+  }
+
+  writer.head = (writer.head + 1) % writer.slots.size();
+  writer.queued--;
+
+  return true;
+}
+
+// Wait for all frames in flight
+static void drain_frames(AsyncSnapshotWriter &writer) {
+  while (writer.queued > 0) {
+    retire_frame(writer, true);
+  }
+}
+
+auto open_async_snapshots(AsyncSnapshotWriter &writer, const char *path, usize first_frame,
+                          usize queue_depth, const SimulationData &sd, const Partition &p,
+                          MPI_Comm comm) -> bool {
+  writer.path = path;
+  writer.rank = p.rank;
+  writer.grid_size = sd.grid_size;
+  writer.row_bytes = packed_row_bytes(sd.grid_size);
+  writer.frames = first_frame;
+
+  const auto error
+      = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &writer.file);
+  if (!check_io(error, "open", path, comm)) {
+    if (writer.file != MPI_FILE_NULL) {
+      MPI_File_close(&writer.file);
+    }
+    return false;
+  }
+
+  // Drop the frames we are about to write, which a previous run may have left behind
+  const auto size_error = MPI_File_set_size(
+      writer.file, static_cast<MPI_Offset>(first_frame * frame_bytes(sd.grid_size)));
+
+  set_frame_view(writer, p);
+
+  keep_error(writer.error, size_error);
+  if (!check_io(writer.error, "open", path, comm)) {
+    MPI_File_close(&writer.file);
+    MPI_Type_free(&writer.frame_type);
+    return false;
+  }
+
+  writer.slots.resize(queue_depth);
+  for (auto &slot : writer.slots) {
+    slot.bits.reserve(p.local_rows * packed_row_bytes(p.local_cols));
+  }
+
+  return true;
+}
+
+auto acquire_frame(AsyncSnapshotWriter &writer) -> StagedFrame & {
+  // Release the frames that are already written, oldest first
+  while (writer.queued > 0 && retire_frame(writer, false)) {
+  }
+
+  if (writer.queued == writer.slots.size()) {
+    const auto start = std::chrono::steady_clock::now();
+    retire_frame(writer, true);
+    const auto end = std::chrono::steady_clock::now();
+
+    writer.stalls++;
+    writer.stall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  }
+
+  // MPI-IO only touches the frames in flight, so the one after them is ours until we submit it
+  return writer.slots[(writer.head + writer.queued) % writer.slots.size()];
+}
+
+void submit_frame(AsyncSnapshotWriter &writer, usize step) {
+  const auto start = std::chrono::steady_clock::now();
+
+  auto &frame = writer.slots[(writer.head + writer.queued) % writer.slots.size()];
+  frame.index = writer.frames++;
+  frame.bytes = static_cast<int>(writer.part_bytes);
+
+  // Offsets count the bytes visible in the view, which has our part of each frame
+  const auto offset = static_cast<MPI_Offset>(frame.index * writer.part_bytes);
+  int result = MPI_SUCCESS;
+
+  if (writer.rank == 0) {
+    frame.header.grid_size = writer.grid_size;
+    frame.header.step = step;
+    frame.header.row_bytes = writer.row_bytes;
+
+    // The header and the block are in two buffers, which a datatype of absolute addresses joins
+    const int lengths[2] = {sizeof(SnapshotHeader), static_cast<int>(frame.bits.size())};
+    MPI_Aint addresses[2];
+    MPI_Get_address(&frame.header, &addresses[0]);
+    MPI_Get_address(frame.bits.data(), &addresses[1]);
+
+    MPI_Datatype memory_type = MPI_DATATYPE_NULL;
+    MPI_Type_create_hindexed(2, lengths, addresses, MPI_BYTE, &memory_type);
+    MPI_Type_commit(&memory_type);
+
+    result = MPI_File_iwrite_at_all(writer.file, offset, MPI_BOTTOM, 1, memory_type,
+                                    &frame.request);
+
+    // MPI keeps the type alive until the write completes
+    MPI_Type_free(&memory_type);
+  } else {
+    result = MPI_File_iwrite_at_all(writer.file, offset, frame.bits.data(), frame.bytes, MPI_BYTE,
+                                    &frame.request);
+  }
+
+  keep_error(writer.error, result);
+
+  writer.queued++;
+  writer.max_queued = std::max(writer.max_queued, writer.queued);
+
+  const auto end = std::chrono::steady_clock::now();
+  writer.start_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void flush_async_snapshots(AsyncSnapshotWriter &writer) { drain_frames(writer); }
+
+void repartition_async_snapshots(AsyncSnapshotWriter &writer, const Partition &p) {
+  drain_frames(writer);
+  set_frame_view(writer, p);
+}
+
+auto close_async_snapshots(AsyncSnapshotWriter &writer, MPI_Comm comm) -> bool {
+  drain_frames(writer);
+
+  keep_error(writer.error, MPI_File_close(&writer.file));
+  MPI_Type_free(&writer.frame_type);
+
+  return check_io(writer.error, "write", writer.path, comm);
+}
+
+void report_async_snapshots(const AsyncSnapshotWriter &writer, MPI_Comm comm) {
+  int rank = 0;
+  int size = 0;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  const long local[3] = {static_cast<long>(writer.stalls), writer.stall_ns, writer.start_ns};
+  long total[3] = {0, 0, 0};
+  long worst[3] = {0, 0, 0};
+  MPI_Reduce(local, total, 3, MPI_LONG, MPI_SUM, 0, comm);
+  MPI_Reduce(local, worst, 3, MPI_LONG, MPI_MAX, 0, comm);
+
+  const auto local_queued = static_cast<long>(writer.max_queued);
+  long max_queued = 0;
+  MPI_Reduce(&local_queued, &max_queued, 1, MPI_LONG, MPI_MAX, 0, comm);
+
+  const auto seconds = [](double t) { return t / 1.0e9; };
+  const auto mean_s = [&](long t) { return seconds(static_cast<double>(t) / size); };
+
+  root_println("Snapshots: {} frames through a queue of {} staging buffers, at most {} in flight",
+               writer.frames, writer.slots.size(), max_queued);
+  root_println("Backpressure: {} stalls, {:.6e} s mean / {:.6e} s max waiting for a staging buffer",
+               total[0], mean_s(total[1]), seconds(static_cast<double>(worst[1])));
+  root_println("Collective writes: {:.6e} s mean / {:.6e} s max starting them", mean_s(total[2]),
+               seconds(static_cast<double>(worst[2])));
+}
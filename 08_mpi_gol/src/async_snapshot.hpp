@@ -0,0 +1,102 @@
+#ifndef MPI_GOL_ASYNC_SNAPSHOT_HPP
+#define MPI_GOL_ASYNC_SNAPSHOT_HPP
+
+/*
+ * Snapshots written in the background.
+ *
+ * The frames have exactly the same layout as the ones of snapshot.hpp, so plot.py reads both. The
+ * difference is that the simulation does not wait for the disk: it packs its block into a staging
+ * buffer and starts a nonblocking collective write of it with MPI_File_iwrite_at_all, then goes on
+ * with the next generations while MPI-IO stores the frame. The writes stay collective, so the MPI
+ * library still merges the pieces of all ranks into large contiguous writes like write_snapshot()
+ * does.
+ *
+ * The staging buffers form a bounded queue of frames in flight. With the default depth of 2 this is
+ * a double buffer: one frame is written while the simulation fills the other. When all buffers are
+ * still in flight the simulation has to wait for the oldest write to complete. That wait is the
+ * backpressure, and we measure it so we know whether the disk keeps up with data_every.
+ *
+ * A file view may not change while writes are in flight, so the view covers every frame at once:
+ * it repeats our part of a frame, which for rank 0 also holds the header, every frame_bytes.
+ * Frame k of the file is then at offset k times the size of our part in the view. Only the main
+ * thread calls MPI, so MPI_THREAD_FUNNELED is enough.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+#include "snapshot.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+struct StagedFrame {
+  usize index{0};                        // Position of the frame in the file
+  SnapshotHeader header;                 // Written by rank 0 in front of its block
+  std::vector<u8> bits;                  // Our block, packed with pack_block()
+  MPI_Request request{MPI_REQUEST_NULL}; // Write of the frame while it is in flight
+  int bytes{0};                          // Bytes the write has to store
+};
+
+struct AsyncSnapshotWriter {
+  MPI_File file{MPI_FILE_NULL};
+  MPI_Datatype frame_type{MPI_DATATYPE_NULL}; // Our part of a frame, repeated every frame_bytes
+  const char *path{nullptr};
+  int rank{0};
+  usize grid_size{0};
+  usize row_bytes{0};  // Bytes per row of the global grid
+  usize part_bytes{0}; // Bytes of our part of a frame, the header included on rank 0
+  usize frames{0};     // Frames handed to MPI-IO so far
+
+  // Ring of staging buffers. slots[head] is the oldest frame in flight, and `queued` frames in all
+  std::vector<StagedFrame> slots;
+  usize head{0};
+  usize queued{0};
+  int error{MPI_SUCCESS}; // First MPI-IO error of this rank, if any
+
+  // Backpressure metrics
+  usize stalls{0};     // Frames that had to wait for a free staging buffer
+  long stall_ns{0};    // Time the simulation spent waiting for a free staging buffer
+  long start_ns{0};    // Time the simulation spent starting writes
+  usize max_queued{0}; // Most frames in flight at once
+};
+
+/*
+ * Open the snapshot file at frame `first_frame` like open_snapshots() does. The column offset of
+ * every partition must be a multiple of 8. Returns false on all ranks if any rank failed.
+ */
+auto open_async_snapshots(AsyncSnapshotWriter &writer, const char *path, usize first_frame,
+                          usize queue_depth, const SimulationData &sd, const Partition &p,
+                          MPI_Comm comm) -> bool;
+
+/*
+ * Get the staging buffer for the next frame, waiting for the oldest write if all of them are in
+ * flight. Fill its bits and then pass it on with submit_frame().
+ */
+auto acquire_frame(AsyncSnapshotWriter &writer) -> StagedFrame &;
+
+// Start the collective write of the frame returned by the last acquire_frame() call
+void submit_frame(AsyncSnapshotWriter &writer, usize step);
+
+/*
+ * Take the following frames from partition `p`, after the load balancer moved our rows. The view
+ * changes with our block, so this waits for the frames in flight. All ranks call it together.
+ */
+void repartition_async_snapshots(AsyncSnapshotWriter &writer, const Partition &p);
+
+/*
+ * Wait for the frames in flight, so that every frame submitted so far is in the file. OpenMPI
+ * fails MPI_File_sync() on any file while a nonblocking write is pending, so a checkpoint has to
+ * flush the snapshots first. That also keeps the snapshots up to the checkpoint for a restart.
+ */
+void flush_async_snapshots(AsyncSnapshotWriter &writer);
+
+/*
+ * Wait for the frames in flight and close the file. Returns false on all ranks if any rank failed
+ * to write a frame.
+ */
+auto close_async_snapshots(AsyncSnapshotWriter &writer, MPI_Comm comm) -> bool;
+
+// Print the backpressure metrics of all ranks
+void report_async_snapshots(const AsyncSnapshotWriter &writer, MPI_Comm comm);
+
+#endif // MPI_GOL_ASYNC_SNAPSHOT_HPP
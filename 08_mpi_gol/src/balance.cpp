@@ -0,0 +1,115 @@
+#include "balance.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+auto balance_rows(const std::vector<usize> &rows, const std::vector<double> &cost, usize min_rows)
+    -> std::vector<usize> {
+  const auto size = rows.size();
+  const auto grid_size = std::accumulate(rows.begin(), rows.end(), usize{0});
+  const auto total = std::accumulate(cost.begin(), cost.end(), 0.0);
+
+  if (total <= 0.0) {
+    return rows;
+  }
+
+  /*
+   * Rank k starts at the row where the prefix sum of the costs reaches k / size of the total. We
+   * walk the ranks to find the one whose rows hold that point, and interpolate inside its rows.
+   */
+  std::vector<usize> cuts(size + 1, 0);
+  cuts[size] = grid_size;
+
+  usize owner = 0;
+  usize rows_before = 0;
+  double cost_before = 0.0;
+
+  for (usize k = 1; k < size; k++) {
+    const auto target = total * static_cast<double>(k) / static_cast<double>(size);
+
+    while (owner + 1 < size && cost_before + cost[owner] < target) {
+      cost_before += cost[owner];
+      rows_before += rows[owner];
+      owner++;
+    }
+
+    const auto fraction
+        = (cost[owner] > 0.0) ? std::clamp((target - cost_before) / cost[owner], 0.0, 1.0) : 0.0;
+    const auto inside = std::llround(fraction * static_cast<double>(rows[owner]));
+    const auto cut = rows_before + static_cast<usize>(inside);
+
+    // Leave at least min_rows to this rank and to each of the ranks after it
+    cuts[k] = std::clamp(cut, cuts[k - 1] + min_rows, grid_size - (size - k) * min_rows);
+  }
+
+  std::vector<usize> balanced(size);
+  for (usize k = 0; k < size; k++) {
+    balanced[k] = cuts[k + 1] - cuts[k];
+  }
+
+  return balanced;
+}
+
+auto partition_from_rows(const std::vector<usize> &rows, usize grid_size, int rank) -> Partition {
+  const auto offset = std::accumulate(rows.begin(), rows.begin() + rank, usize{0});
+  return Partition{rank, static_cast<int>(rows.size()), rows[static_cast<usize>(rank)], offset,
+                   grid_size, 0};
+}
+
+void migrate_rows(const std::vector<u8> &from_bits, const std::vector<usize> &from_rows,
+                  std::vector<u8> &to_bits, const std::vector<usize> &to_rows, usize row_bytes,
+                  MPI_Comm comm) {
+  int rank = 0, size = 0;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  // Global index of the first row of each rank, before and after, and one past the last row
+  std::vector<usize> from_first(static_cast<usize>(size) + 1, 0);
+  std::vector<usize> to_first(static_cast<usize>(size) + 1, 0);
+  std::partial_sum(from_rows.begin(), from_rows.end(), from_first.begin() + 1);
+  std::partial_sum(to_rows.begin(), to_rows.end(), to_first.begin() + 1);
+
+  const auto me = static_cast<usize>(rank);
+  to_bits.assign(to_rows[me] * row_bytes, 0);
+
+  std::vector<MPI_Request> reqs;
+  reqs.reserve(2 * from_rows.size());
+
+  for (int j = 0; j < size; j++) {
+    const auto other = static_cast<usize>(j);
+
+    // The rows we had that rank j owns now
+    const auto send_first = std::max(from_first[me], to_first[other]);
+    const auto send_last = std::min(from_first[me + 1], to_first[other + 1]);
+
+    // The rows rank j had that we own now
+    const auto recv_first = std::max(from_first[other], to_first[me]);
+    const auto recv_last = std::min(from_first[other + 1], to_first[me + 1]);
+
+    if (j == rank) {
+      if (send_first < send_last) {
+        std::copy_n(from_bits.data() + (send_first - from_first[me]) * row_bytes,
+                    (send_last - send_first) * row_bytes,
+                    to_bits.data() + (send_first - to_first[me]) * row_bytes);
+      }
+      continue;
+    }
+
+    if (recv_first < recv_last) {
+      reqs.emplace_back();
+      MPI_Irecv(to_bits.data() + (recv_first - to_first[me]) * row_bytes,
+                static_cast<int>((recv_last - recv_first) * row_bytes), MPI_BYTE, j, 0, comm,
+                &reqs.back());
+    }
+
+    if (send_first < send_last) {
+      reqs.emplace_back();
+      MPI_Isend(from_bits.data() + (send_first - from_first[me]) * row_bytes,
+                static_cast<int>((send_last - send_first) * row_bytes), MPI_BYTE, j, 0, comm,
+                &reqs.back());
+    }
+  }
+
+  MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+}
@@ -0,0 +1,44 @@
+#ifndef MPI_GOL_BALANCE_HPP
+#define MPI_GOL_BALANCE_HPP
+
+/*
+ * Dynamic load balancing for the row decomposition.
+ *
+ * compute_partition() gives every rank the same number of rows, which is only fair if every rank
+ * updates a row in the same time. On a cluster with mixed nodes, or when OS noise or cache effects
+ * hit some ranks harder than others, the fast ranks end up waiting for the slowest one at every
+ * halo exchange.
+ *
+ * So every balance_every generations we look at how long each rank spent computing since the last
+ * check. Spreading the time of a rank evenly over its rows gives a cost for every row of the grid,
+ * and we cut the prefix sum of those costs into `size` equal pieces. Rows then move to their new
+ * owners with point to point messages. As the rows only shift along the ring of ranks, most of
+ * them go to a neighbour.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+/*
+ * New number of rows for each rank. `rows` holds the current number of rows of each rank and
+ * `cost` the time each rank spent on them. Every rank gets at least min_rows rows.
+ */
+auto balance_rows(const std::vector<usize> &rows, const std::vector<double> &cost, usize min_rows)
+    -> std::vector<usize>;
+
+// Partition of `rank` when each rank owns rows[rank] whole rows, in rank order
+auto partition_from_rows(const std::vector<usize> &rows, usize grid_size, int rank) -> Partition;
+
+/*
+ * Move our rows from partition `from` to partition `to`, with one message for every other rank
+ * whose new rows overlap our old ones. Both hold the rows packed with pack_block(), `row_bytes`
+ * bytes per row.
+ */
+void migrate_rows(const std::vector<u8> &from_bits, const std::vector<usize> &from_rows,
+                  std::vector<u8> &to_bits, const std::vector<usize> &to_rows, usize row_bytes,
+                  MPI_Comm comm);
+
+#endif // MPI_GOL_BALANCE_HPP
@@ -0,0 +1,58 @@
+/*
+ * Vectorized update of byte-per-cell rows.
+ */
+
+#include "cells.hpp"
+
+/*
+ * The interior of a row (every column except the first and the last) has no periodic wrap, so
+ * every cell is computed with the same branch free expression and the loop vectorizes. GCC and
+ * Clang compile one clone of the function per listed target and pick the best one for the CPU we
+ * are running on the first time it is called. "default" is the baseline x86-64 target, which
+ * always has SSE2.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define GOL_TARGET_CLONES __attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+#else
+#  define GOL_TARGET_CLONES
+#endif
+
+/*
+ * The loop itself, shared by the kernels of all rules. Each kernel below inlines it into every one
+ * of its clones, so the rule is known at compile time when the loop is vectorized.
+ */
+template <typename Rule>
+static inline void update_interior(const Rule &rule, const u8 *__restrict up,
+                                   const u8 *__restrict mid, const u8 *__restrict dn,
+                                   u8 *__restrict out, usize n) {
+  for (usize c = 1; c + 1 < n; c++) {
+    const auto nsum = static_cast<u8>(up[c - 1] + up[c] + up[c + 1] + mid[c - 1] + mid[c + 1]
+                                      + dn[c - 1] + dn[c] + dn[c + 1]);
+
+    out[c] = rule.next(nsum, mid[c]);
+  }
+}
+
+GOL_TARGET_CLONES
+void byte_update_interior(ConwayRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n) {
+  update_interior(rule, up, mid, dn, out, n);
+}
+
+GOL_TARGET_CLONES
+void byte_update_interior(HighLifeRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n) {
+  update_interior(rule, up, mid, dn, out, n);
+}
+
+GOL_TARGET_CLONES
+void byte_update_interior(DayNightRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n) {
+  update_interior(rule, up, mid, dn, out, n);
+}
+
+GOL_TARGET_CLONES
+void byte_update_interior(MaskRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n) {
+  update_interior(rule, up, mid, dn, out, n);
+}
@@ -0,0 +1,551 @@
+#ifndef MPI_GOL_CELLS_HPP
+#define MPI_GOL_CELLS_HPP
+
+/*
+ * Cell storage policies for the game of life.
+ *
+ * A storage policy tells the simulation how a row of cells is laid out in memory, how many MPI
+ * elements a row occupies (this is what travels in the halo exchange) and how to compute the next
+ * state of a row from the three rows around it. The simulation loop is written once and is
+ * instantiated for each of the policies below.
+ *
+ * The update functions also take the rule of the game (see rules.hpp) as a template parameter, so
+ * each pair of storage and rule gets its own kernel.
+ */
+
+#include "rules.hpp"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mpi.h>
+#include <mutex>
+
+using usize = std::size_t;
+using u8 = std::uint8_t;
+using u32 = std::uint32_t;
+using u64 = std::uint64_t;
+using i64 = std::int64_t;
+
+/*
+ * What happened to the cells of a span between two generations: how many are alive in the new
+ * one, and how many were born or died on the way.
+ */
+struct CellCounts {
+  long live{0};
+  long births{0};
+  long deaths{0};
+
+  auto operator+=(const CellCounts &other) -> CellCounts & {
+    live += other.live;
+    births += other.births;
+    deaths += other.deaths;
+    return *this;
+  }
+};
+
+/*
+ * Compute columns 1..n-2 of a byte-per-cell row. Defined in byte_kernel.cpp, which is compiled
+ * with one clone per SIMD instruction set and dispatched at runtime. There is one kernel for each
+ * of the fixed rules of rules.hpp, and one for any other rule.
+ */
+void byte_update_interior(ConwayRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n);
+void byte_update_interior(HighLifeRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n);
+void byte_update_interior(DayNightRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n);
+void byte_update_interior(MaskRule rule, const u8 *__restrict up, const u8 *__restrict mid,
+                          const u8 *__restrict dn, u8 *__restrict out, usize n);
+
+/*
+ * One cell per byte. This is the simplest representation: a cell is either 0 or 1 and we can sum
+ * neighbours directly.
+ */
+struct ByteCells {
+  using word = u8;
+
+  // Rows may carry their own halo columns, which the 2D block decomposition needs
+  static constexpr bool block_support = true;
+
+  // Rows are updated one at a time
+  static constexpr usize rows_per_update = 1;
+
+  static auto mpi_type() -> MPI_Datatype { return MPI_UNSIGNED_CHAR; }
+
+  static constexpr usize cells_per_word = 1;
+
+  // Number of words needed to store a row of n cells
+  static constexpr auto row_words(usize n) -> usize { return n; }
+
+  static inline auto get(const word *row, usize c) -> u8 { return row[c]; }
+  static inline void set(word *row, usize c, u8 state) { row[c] = state; }
+
+  /*
+   * Set the n <= 64 cells from cell c on to the low n bits of `bits`, 16 cells at a time. A
+   * multiplication copies 8 bits to all bytes of a word, the mask keeps bit j in byte j and the
+   * addition carries any set bit of a byte into its top bit, which we shift down.
+   */
+  static inline void set_cells(word *row, usize c, u64 bits, usize n) {
+    const auto spread = [](u64 b) -> u64 {
+      const auto lanes = ((b & 0xff) * 0x0101010101010101) & 0x8040201008040201;
+      return ((lanes + 0x7f7f7f7f7f7f7f7f) >> 7) & 0x0101010101010101;
+    };
+
+    usize j = 0;
+    for (; j + 16 <= n; j += 16) {
+      const u64 group[2] = {spread(bits >> j), spread(bits >> (j + 8))};
+      std::memcpy(row + c + j, group, sizeof(group));
+    }
+    for (; j < n; j++) {
+      row[c + j] = static_cast<u8>((bits >> j) & 1);
+    }
+  }
+
+  // Number of live cells in a row of n cells
+  static inline auto count_live(const word *row, usize n) -> long {
+    long sum = 0;
+    for (usize c = 0; c < n; c++) {
+      sum += row[c];
+    }
+    return sum;
+  }
+
+  /*
+   * Add the counts of words w0..w1-1 of a row, which held `old_row` and now holds `new_row`. We
+   * call it right after computing the row, while both are still in cache.
+   */
+  static inline void tally(const word *old_row, const word *new_row, usize w0, usize w1,
+                           CellCounts &counts) {
+    unsigned live = 0, births = 0, deaths = 0;
+    for (usize c = w0; c < w1; c++) {
+      live += new_row[c];
+      births += new_row[c] & ~old_row[c];
+      deaths += old_row[c] & ~new_row[c];
+    }
+
+    counts.live += live;
+    counts.births += births;
+    counts.deaths += deaths;
+  }
+
+  /*
+   * Next state of cell c of row `mid`. `up` and `dn` are the rows immediately above and below it.
+   * Rows are periodic, so the left neighbour of the first cell is the last cell.
+   */
+  template <typename Rule>
+  static inline auto update_cell(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                 usize c, usize n) -> u8 {
+    // Periodic row boundary condition
+    const usize left = (c == 0) ? n - 1 : c - 1;
+    const usize right = (c + 1 == n) ? 0 : c + 1;
+
+    int nsum = 0;
+    // three rows: r-1, r, r+1
+    nsum += up[left];
+    nsum += up[c];
+    nsum += up[right];
+
+    nsum += mid[left];
+    // skip mid[c] itself
+    nsum += mid[right];
+
+    nsum += dn[left];
+    nsum += dn[c];
+    nsum += dn[right];
+
+    // Born or survives depending on the rule
+    return rule.next(static_cast<u8>(nsum), mid[c]);
+  }
+
+  /*
+   * Compute the next state of row `mid` into `out`. Only the first and last columns need the
+   * periodic wrap, so we peel them off and hand the rest of the row to the vectorized kernel.
+   */
+  template <typename Rule>
+  static inline void update_row(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                word *out, usize n) {
+    if (n < 3) {
+      for (usize c = 0; c < n; c++) {
+        out[c] = update_cell(rule, up, mid, dn, c, n);
+      }
+      return;
+    }
+
+    out[0] = update_cell(rule, up, mid, dn, 0, n);
+    byte_update_interior(rule, up, mid, dn, out, n);
+    out[n - 1] = update_cell(rule, up, mid, dn, n - 1, n);
+  }
+
+  // Like update_row(), but only for the `count` cells starting at cell `first`
+  template <typename Rule>
+  static inline void update_span(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                 word *out, usize n, usize first, usize count) {
+    auto last = first + count;
+
+    if (first == 0) {
+      out[0] = update_cell(rule, up, mid, dn, 0, n);
+      first = 1;
+    }
+
+    if (last == n && last > first) {
+      out[n - 1] = update_cell(rule, up, mid, dn, n - 1, n);
+      last = n - 1;
+    }
+
+    // The kernel computes cells 1..len-2 of what it is given, so we hand it one cell more per side
+    if (last > first) {
+      byte_update_interior(rule, up + first - 1, mid + first - 1, dn + first - 1, out + first - 1,
+                           last - first + 2);
+    }
+  }
+
+  /*
+   * Compute the next state of cells 1..n of a row that stores its own halo columns at 0 and n + 1.
+   * No wrap is needed, so the whole row goes through the vectorized kernel.
+   */
+  template <typename Rule>
+  static inline void update_halo_row(const Rule &rule, const word *up, const word *mid,
+                                     const word *dn, word *out, usize n) {
+    byte_update_interior(rule, up, mid, dn, out, n + 2);
+  }
+};
+
+/*
+ * 64 cells per 64 bit word. Cell c of a row lives in bit (c % 64) of word (c / 64). Bits past the
+ * end of the row in the last word are padding and are always kept at zero.
+ *
+ * Instead of summing neighbours one cell at a time, we shift whole words so that the west and east
+ * neighbours of every cell line up with the cell itself and then add the eight neighbour words
+ * with bitwise full adders. This evaluates the rule for 64 cells with a couple dozen instructions.
+ */
+struct PackedCells {
+  using word = u64;
+
+  // A halo column would be a single bit, so packed rows only support the row decomposition
+  static constexpr bool block_support = false;
+
+  static constexpr usize rows_per_update = 1;
+
+  static auto mpi_type() -> MPI_Datatype { return MPI_UINT64_T; }
+
+  static constexpr usize cells_per_word = 64;
+
+  static constexpr auto row_words(usize n) -> usize { return (n + 63) / 64; }
+
+  static inline auto get(const word *row, usize c) -> u8 {
+    return static_cast<u8>((row[c / 64] >> (c % 64)) & 1);
+  }
+
+  static inline void set(word *row, usize c, u8 state) {
+    const auto mask = u64{1} << (c % 64);
+    row[c / 64] = (state != 0) ? (row[c / 64] | mask) : (row[c / 64] & ~mask);
+  }
+
+  // Set the n <= 64 cells from cell c on, which must be a multiple of 64, to the low n bits of bits
+  static inline void set_cells(word *row, usize c, u64 bits, usize n) {
+    const auto mask = (n == 64) ? ~u64{0} : (u64{1} << n) - 1;
+    row[c / 64] = (row[c / 64] & ~mask) | (bits & mask);
+  }
+
+  static inline auto count_live(const word *row, usize n) -> long {
+    long sum = 0;
+    for (usize w = 0; w < row_words(n); w++) {
+      sum += std::popcount(row[w]);
+    }
+    return sum;
+  }
+
+  // Padding bits are zero in both rows, so whole words count right
+  static inline void tally(const word *old_row, const word *new_row, usize w0, usize w1,
+                           CellCounts &counts) {
+    for (usize w = w0; w < w1; w++) {
+      counts.live += std::popcount(new_row[w]);
+      counts.births += std::popcount(new_row[w] & ~old_row[w]);
+      counts.deaths += std::popcount(old_row[w] & ~new_row[w]);
+    }
+  }
+
+  // Word holding the west neighbour (c - 1) of every cell in word w, with periodic wrap
+  static inline auto west(const word *row, usize w, usize n) -> word {
+    const auto carry = (w == 0) ? static_cast<word>(get(row, n - 1)) : row[w - 1] >> 63;
+    return (row[w] << 1) | carry;
+  }
+
+  // Word holding the east neighbour (c + 1) of every cell in word w, with periodic wrap
+  static inline auto east(const word *row, usize w, usize n) -> word {
+    if (w + 1 == row_words(n)) {
+      return (row[w] >> 1) | ((row[0] & 1) << ((n - 1) % 64));
+    }
+    return (row[w] >> 1) | (row[w + 1] << 63);
+  }
+
+  // Sum of three bits per lane, returned as (sum, carry)
+  static inline void add3(word a, word b, word c, word &sum, word &carry) {
+    const auto ab = a ^ b;
+    sum = ab ^ c;
+    carry = (a & b) | (ab & c);
+  }
+
+  /*
+   * The rule for 64 cells at once. The neighbour count of every lane is accumulated into the four
+   * bit planes (c0, c1, c2, c3) of a 4 bit number, from which the rule is evaluated directly.
+   */
+  template <typename Rule>
+  static inline auto life_word(const Rule &rule, word ul, word u, word ur, word ml, word m,
+                               word mr, word dl, word d, word dr) -> word {
+    word u0 = 0, u1 = 0, d0 = 0, d1 = 0;
+    add3(ul, u, ur, u0, u1);
+    add3(dl, d, dr, d0, d1);
+    const auto m0 = ml ^ mr;
+    const auto m1 = ml & mr;
+
+    // Weight 1 plane
+    word c0 = 0, k = 0;
+    add3(u0, d0, m0, c0, k);
+
+    // Weight 2 planes: u1 + d1 + m1 + k, which is at most 4
+    const auto p = u1 ^ d1;
+    const auto q = m1 ^ k;
+    const auto pq = p & q;
+    const auto ud = u1 & d1;
+    const auto mk = m1 & k;
+
+    const auto c1 = p ^ q;
+    const auto c2 = pq ^ ud ^ mk;
+    const auto c3 = ud & mk;
+
+    return rule.next_word(CountPlanes{c0, c1, c2, c3}, m);
+  }
+
+  template <typename Rule>
+  static inline void update_row(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                word *out, usize n) {
+    update_span(rule, up, mid, dn, out, n, 0, n);
+  }
+
+  /*
+   * Like update_row(), but only for the `count` cells starting at cell `first`. Whole words are
+   * always computed, so first should be a multiple of 64.
+   */
+  template <typename Rule>
+  static inline void update_span(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                 word *out, usize n, usize first, usize count) {
+    const auto words = row_words(n);
+    const auto last = (first + count - 1) / 64;
+
+    for (usize w = first / 64; w <= last; w++) {
+      out[w] = life_word(rule, west(up, w, n), up[w], east(up, w, n), west(mid, w, n), mid[w],
+                         east(mid, w, n), west(dn, w, n), dn[w], east(dn, w, n));
+    }
+
+    // Keep the padding bits of the last word clear
+    if (last + 1 == words && n % 64 != 0) {
+      out[words - 1] &= (u64{1} << (n % 64)) - 1;
+    }
+  }
+};
+
+/*
+ * Packed rows like PackedCells, updated through a lookup table instead of adders.
+ *
+ * The next state of a 2 x 2 block of cells only depends on the 4 x 4 window around it, which is 16
+ * bits. So we compute the next block of every possible window once, and then a generation is one
+ * table lookup per 2 x 2 block: gather the 4 bits of each of the 4 rows of the window into an
+ * index, and read the 4 new cells. The table takes 64 KiB, which sits in L2 cache.
+ *
+ * This is about the least arithmetic per cell we can do without SIMD, which makes it a good fit for
+ * CPUs without wide vector units. On CPUs that have them, the full adders of PackedCells process
+ * more cells per instruction.
+ *
+ * As a lookup gives two rows, the generation loop hands us the interior rows in pairs (see
+ * update_pair()). Rows updated on their own use the upper half of the lookup.
+ */
+struct TableCells : PackedCells {
+  static constexpr usize rows_per_update = 2;
+
+  /*
+   * Entry `index` is the next state of the centre 2 x 2 block of a 4 x 4 window. Bit 4 r + c of
+   * the index is the cell in row r and column c of the window. Bit 2 r + c of the entry is the cell
+   * in row r and column c of the block, which is cell (r + 1, c + 1) of the window.
+   */
+  using Table = std::array<u8, 65536>;
+
+  template <typename Rule> static auto make_table(const Rule &rule) -> Table {
+    Table table{};
+
+    for (u32 index = 0; index < table.size(); index++) {
+      const auto cell = [&](u32 r, u32 c) { return static_cast<u8>((index >> (4 * r + c)) & 1); };
+
+      u8 block = 0;
+      for (u32 r = 1; r <= 2; r++) {
+        for (u32 c = 1; c <= 2; c++) {
+          u8 nsum = 0;
+          for (u32 i = r - 1; i <= r + 1; i++) {
+            for (u32 j = c - 1; j <= c + 1; j++) {
+              nsum = static_cast<u8>(nsum + cell(i, j));
+            }
+          }
+          nsum = static_cast<u8>(nsum - cell(r, c));
+
+          block = static_cast<u8>(block | (rule.next(nsum, cell(r, c)) << (2 * (r - 1) + c - 1)));
+        }
+      }
+
+      table[index] = block;
+    }
+
+    return table;
+  }
+
+  // The table of a rule, built the first time it is needed. A FixedRule has its masks in its type
+  template <typename Rule> static auto table(const Rule &rule) -> const Table & {
+    static const Table rule_table = make_table(rule);
+    return rule_table;
+  }
+
+  /*
+   * All MaskRules share a type, so their tables are cached by masks instead. The cache is shared by
+   * all threads, and each thread keeps the last table it got so that it only takes the lock when
+   * the rule changes. A std::map never moves its entries, so the tables stay where they are.
+   */
+  static auto table(const MaskRule &rule) -> const Table & {
+    thread_local MaskRule last_rule{};
+    thread_local const Table *last_table = nullptr;
+
+    if (last_table == nullptr || rule != last_rule) {
+      static std::mutex lock;
+      static std::map<std::pair<u32, u32>, Table> tables;
+
+      const std::scoped_lock guard(lock);
+      const auto [entry, inserted] = tables.try_emplace({rule.birth, rule.survive});
+      if (inserted) {
+        entry->second = make_table(rule);
+      }
+
+      last_rule = rule;
+      last_table = &entry->second;
+    }
+
+    return *last_table;
+  }
+
+  /*
+   * Cells 64 w - 1 to 64 w + 64 of a row, i.e. word w and one neighbour on each side. Bit k of
+   * `low` is cell 64 w - 1 + k, and bits 0 and 1 of `high` are cells 64 w + 63 and 64 w + 64.
+   */
+  struct Window {
+    word low;
+    word high;
+
+    // The 4 cells 2 j - 1 to 2 j + 2 of the word, for the block of cells 2 j and 2 j + 1
+    inline auto nibble(usize j) const -> u32 {
+      if (j < 31) {
+        return static_cast<u32>((low >> (2 * j)) & 15);
+      }
+      return static_cast<u32>(((low >> 62) & 3) | ((high & 3) << 2));
+    }
+  };
+
+  static inline auto window(const word *row, usize w, usize n) -> Window {
+    const auto words = row_words(n);
+    auto cells = row[w];
+    word east_cell = 0;
+
+    /*
+     * Past the end of a row comes its first cell. If the last word is not full, we put it in the
+     * first padding bit, otherwise it is the east neighbour of the word.
+     */
+    if (w + 1 == words) {
+      if (n % 64 != 0) {
+        cells |= (row[0] & 1) << (n % 64);
+      } else {
+        east_cell = row[0] & 1;
+      }
+    } else {
+      east_cell = row[w + 1] & 1;
+    }
+
+    const auto west_cell = (w == 0) ? static_cast<word>(get(row, n - 1)) : row[w - 1] >> 63;
+
+    return Window{(cells << 1) | west_cell, (cells >> 63) | (east_cell << 1)};
+  }
+
+  // Next state of rows 1 and 2 of word w, from rows 0 to 3 around them
+  static inline void pair_word(const Table &tab, const word *r0, const word *r1, const word *r2,
+                               const word *r3, usize w, usize n, word &out1, word &out2) {
+    const auto w0 = window(r0, w, n);
+    const auto w1 = window(r1, w, n);
+    const auto w2 = window(r2, w, n);
+    const auto w3 = window(r3, w, n);
+
+    word next1 = 0, next2 = 0;
+
+    for (usize j = 0; j < 32; j++) {
+      const auto index = w0.nibble(j) | (w1.nibble(j) << 4) | (w2.nibble(j) << 8)
+                         | (w3.nibble(j) << 12);
+      const word block = tab[index];
+
+      next1 |= (block & 3) << (2 * j);
+      next2 |= (block >> 2) << (2 * j);
+    }
+
+    out1 = next1;
+    out2 = next2;
+  }
+
+  /*
+   * Compute the next state of rows r1 and r2 (rows 1 and 2 of the window) into out1 and out2, for
+   * the `count` cells starting at cell `first`. Like for PackedCells, whole words are computed.
+   */
+  template <typename Rule>
+  static inline void update_pair(const Rule &rule, const word *r0, const word *r1, const word *r2,
+                                 const word *r3, word *out1, word *out2, usize n, usize first,
+                                 usize count) {
+    const auto &tab = table(rule);
+    const auto words = row_words(n);
+    const auto last = (first + count - 1) / 64;
+
+    for (usize w = first / 64; w <= last; w++) {
+      pair_word(tab, r0, r1, r2, r3, w, n, out1[w], out2[w]);
+    }
+
+    // Keep the padding bits of the last word clear
+    if (last + 1 == words && n % 64 != 0) {
+      out1[words - 1] &= (u64{1} << (n % 64)) - 1;
+      out2[words - 1] &= (u64{1} << (n % 64)) - 1;
+    }
+  }
+
+  template <typename Rule>
+  static inline void update_row(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                word *out, usize n) {
+    update_span(rule, up, mid, dn, out, n, 0, n);
+  }
+
+  /*
+   * A single row is the upper row of a pair. That row only depends on the three rows around it, so
+   * any row will do as the fourth one of the window.
+   */
+  template <typename Rule>
+  static inline void update_span(const Rule &rule, const word *up, const word *mid, const word *dn,
+                                 word *out, usize n, usize first, usize count) {
+    const auto &tab = table(rule);
+    const auto words = row_words(n);
+    const auto last = (first + count - 1) / 64;
+
+    for (usize w = first / 64; w <= last; w++) {
+      word unused = 0;
+      pair_word(tab, up, mid, dn, dn, w, n, out[w], unused);
+    }
+
+    if (last + 1 == words && n % 64 != 0) {
+      out[words - 1] &= (u64{1} << (n % 64)) - 1;
+    }
+  }
+};
+
+#endif // MPI_GOL_CELLS_HPP
@@ -0,0 +1,121 @@
+#include "checkpoint.hpp"
+#include "snapshot.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+auto write_checkpoint(const char *path, usize step, const SimulationData &sd, const Partition &p,
+                      const std::vector<u8> &local_bits, MPI_Comm comm) -> bool {
+  const auto tmp_path = std::string(path) + ".tmp";
+
+  MPI_File file = MPI_FILE_NULL;
+  const auto open_error = MPI_File_open(comm, tmp_path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                                        MPI_INFO_NULL, &file);
+  if (!check_io(open_error, "open", tmp_path.c_str(), comm)) {
+    if (file != MPI_FILE_NULL) {
+      MPI_File_close(&file);
+    }
+    return false;
+  }
+
+  int error = MPI_File_set_size(file, 0);
+
+  if (p.rank == 0) {
+    CheckpointHeader header;
+    header.grid_size = sd.grid_size;
+    header.step = step;
+    header.row_bytes = packed_row_bytes(sd.grid_size);
+    header.random_seed = sd.random_seed;
+
+    MPI_Status status;
+    const auto result = MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, &status);
+    keep_error(error, write_result(result, status, MPI_BYTE, sizeof(header)));
+  }
+
+  // The grid goes through the same subarray view as the snapshots
+  auto block_type = make_block_type(sd.grid_size, p);
+  keep_error(error, MPI_File_set_view(file, sizeof(CheckpointHeader), MPI_BYTE, block_type,
+                                      "native", MPI_INFO_NULL));
+
+  const auto count = static_cast<int>(local_bits.size());
+  MPI_Status status;
+  const auto result = MPI_File_write_at_all(file, 0, local_bits.data(), count, MPI_BYTE, &status);
+  keep_error(error, write_result(result, status, MPI_BYTE, count));
+
+  // The data must be on disk, not in a cache, before it replaces the previous checkpoint
+  keep_error(error, MPI_File_sync(file));
+
+  /*
+   * The collective write reports the count we asked for even when the aggregator that stored our
+   * rows hit a short write, so we also check that the file holds the whole grid.
+   */
+  MPI_Offset size = 0;
+  keep_error(error, MPI_File_get_size(file, &size));
+  const auto expected = sizeof(CheckpointHeader) + sd.grid_size * packed_row_bytes(sd.grid_size);
+  if (error == MPI_SUCCESS && static_cast<usize>(size) != expected) {
+    error = MPI_ERR_IO;
+  }
+
+  keep_error(error, MPI_File_close(&file));
+  MPI_Type_free(&block_type);
+
+  // Only replace the previous checkpoint once every rank is done with the new one
+  if (!check_io(error, "write", tmp_path.c_str(), comm)) {
+    if (p.rank == 0) {
+      std::remove(tmp_path.c_str());
+    }
+    return false;
+  }
+
+  int renamed = 1;
+
+  if (p.rank == 0 && std::rename(tmp_path.c_str(), path) != 0) {
+    fmt::println(stderr, "Error: could not rename {} to {}: {}", tmp_path, path,
+                 std::strerror(errno));
+    renamed = 0;
+  }
+
+  MPI_Bcast(&renamed, 1, MPI_INT, 0, comm);
+
+  return renamed == 1;
+}
+
+auto read_checkpoint_header(const char *path, CheckpointHeader &header, MPI_Comm comm) -> bool {
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+
+  MPI_File file = MPI_FILE_NULL;
+  if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+    return false;
+  }
+
+  // Rank 0 reads the header and shares it, rather than every rank hitting the file system
+  if (rank == 0) {
+    MPI_File_read_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  MPI_Bcast(&header, sizeof(header), MPI_BYTE, 0, comm);
+
+  MPI_File_close(&file);
+
+  const CheckpointHeader expected;
+  return std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+         && header.row_bytes == packed_row_bytes(header.grid_size);
+}
+
+void read_checkpoint(const char *path, const SimulationData &sd, const Partition &p,
+                     std::vector<u8> &local_bits, MPI_Comm comm) {
+  local_bits.assign(p.local_rows * packed_row_bytes(p.local_cols), 0);
+
+  MPI_File file = MPI_FILE_NULL;
+  MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+
+  auto block_type = make_block_type(sd.grid_size, p);
+  MPI_File_set_view(file, sizeof(CheckpointHeader), MPI_BYTE, block_type, "native", MPI_INFO_NULL);
+  MPI_File_read_at_all(file, 0, local_bits.data(), static_cast<int>(local_bits.size()), MPI_BYTE,
+                       MPI_STATUS_IGNORE);
+
+  MPI_File_close(&file);
+  MPI_Type_free(&block_type);
+}
@@ -0,0 +1,57 @@
+#ifndef MPI_GOL_CHECKPOINT_HPP
+#define MPI_GOL_CHECKPOINT_HPP
+
+/*
+ * Checkpoints, so that a run killed by the queue time limit can be picked up where it stopped.
+ *
+ * A checkpoint holds everything the simulation needs to carry on: the global grid, the generation
+ * it is at and the random seed. The grid is stored like a snapshot frame, one bit per cell, after
+ * a CheckpointHeader. Since the file holds the global grid and not the blocks of the ranks that
+ * wrote it, a run can restart on any number of ranks: each rank reads the block of its own
+ * partition, whatever the partitions of the previous run were.
+ *
+ * The random number generator is only drawn while initializing the grid, so the seed is all of its
+ * state we need to keep.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+struct CheckpointHeader {
+  char magic[8]{'G', 'O', 'L', 'C', 'K', 'P', 'T', '1'};
+  u64 grid_size{0};   // Number of rows and columns in the grid
+  u64 step{0};        // Generation stored in the checkpoint, which is the next one to compute
+  u64 row_bytes{0};   // Bytes per row of the grid
+  u64 random_seed{0}; // Random seed of the run
+};
+
+static_assert(sizeof(CheckpointHeader) == 40, "CheckpointHeader must not have padding");
+
+/*
+ * Write a checkpoint of generation `step`. `local_bits` holds our block packed with pack_block().
+ *
+ * The checkpoint is written to a temporary file that only replaces `path` once every rank has
+ * written and synced its part, so being killed or running out of disk space while writing a
+ * checkpoint never costs us the previous one. Returns false on all ranks if the checkpoint could
+ * not be written, in which case `path` still holds the previous one.
+ */
+auto write_checkpoint(const char *path, usize step, const SimulationData &sd, const Partition &p,
+                      const std::vector<u8> &local_bits, MPI_Comm comm) -> bool;
+
+/*
+ * Read the header of a checkpoint on all ranks of `comm`. Returns false if the file can't be opened
+ * or is not a checkpoint.
+ */
+auto read_checkpoint_header(const char *path, CheckpointHeader &header, MPI_Comm comm) -> bool;
+
+/*
+ * Read our block of the grid of a checkpoint, packed like pack_block() does. The grid size of `sd`
+ * must be the one of the checkpoint.
+ */
+void read_checkpoint(const char *path, const SimulationData &sd, const Partition &p,
+                     std::vector<u8> &local_bits, MPI_Comm comm);
+
+#endif // MPI_GOL_CHECKPOINT_HPP
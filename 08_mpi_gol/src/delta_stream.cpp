@@ -0,0 +1,220 @@
+#include "delta_stream.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void encode_zero_runs(const std::vector<u8> &data, std::vector<u8> &out) {
+  const auto varint = [&](usize value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<u8>(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<u8>(value));
+  };
+
+  const auto n = data.size();
+  usize i = 0;
+
+  while (i < n) {
+    auto zeros_end = i;
+    while (zeros_end < n && data[zeros_end] == 0) {
+      zeros_end++;
+    }
+
+    // The literals end where at least two zeros in a row start
+    auto literals_end = zeros_end;
+    while (literals_end < n
+           && (data[literals_end] != 0
+               || (literals_end + 1 < n && data[literals_end + 1] != 0))) {
+      literals_end++;
+    }
+
+    varint(zeros_end - i);
+    varint(literals_end - zeros_end);
+    out.insert(out.end(), data.begin() + static_cast<std::ptrdiff_t>(zeros_end),
+               data.begin() + static_cast<std::ptrdiff_t>(literals_end));
+
+    i = literals_end;
+  }
+}
+
+auto open_delta_stream(DeltaStream &stream, const char *path, const char *index_path,
+                       usize first_frame, const SimulationData &sd, const Partition &p,
+                       MPI_Comm comm) -> bool {
+  stream.path = path;
+  stream.p = p;
+  stream.grid_size = sd.grid_size;
+  stream.keyframe_every = sd.keyframe_every;
+
+  const auto close_files = [&] {
+    if (stream.file != MPI_FILE_NULL) {
+      MPI_File_close(&stream.file);
+    }
+    if (stream.index != MPI_FILE_NULL) {
+      MPI_File_close(&stream.index);
+    }
+  };
+
+  const auto error
+      = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &stream.file);
+  if (!check_io(error, "open", path, comm)) {
+    close_files();
+    return false;
+  }
+
+  const auto index_error = MPI_File_open(comm, index_path, MPI_MODE_CREATE | MPI_MODE_RDWR,
+                                         MPI_INFO_NULL, &stream.index);
+  if (!check_io(index_error, "open", index_path, comm)) {
+    close_files();
+    return false;
+  }
+
+  /*
+   * Keep the frames before first_frame. Only the index knows where they end, so rank 0 looks it
+   * up. If the index has fewer frames than that, we keep all of them.
+   */
+  u64 kept[2] = {0, 0}; // Frames and bytes of the stream we keep
+  int read_error = MPI_SUCCESS;
+
+  if (p.rank == 0) {
+    MPI_Offset index_size = 0;
+    keep_error(read_error, MPI_File_get_size(stream.index, &index_size));
+
+    kept[0] = std::min<u64>(first_frame, static_cast<u64>(index_size) / sizeof(IndexEntry));
+
+    if (kept[0] > 0) {
+      IndexEntry last;
+      const auto last_offset = static_cast<MPI_Offset>((kept[0] - 1) * sizeof(IndexEntry));
+      keep_error(read_error, MPI_File_read_at(stream.index, last_offset, &last, sizeof(last),
+                                              MPI_BYTE, MPI_STATUS_IGNORE));
+      kept[1] = last.offset + last.bytes;
+    }
+  }
+
+  if (!check_io(read_error, "read", index_path, comm)) {
+    close_files();
+    return false;
+  }
+
+  MPI_Bcast(kept, 2, MPI_UINT64_T, 0, comm);
+
+  const auto index_bytes = static_cast<MPI_Offset>(kept[0] * sizeof(IndexEntry));
+  int size_error = MPI_File_set_size(stream.file, static_cast<MPI_Offset>(kept[1]));
+  keep_error(size_error, MPI_File_set_size(stream.index, index_bytes));
+  if (!check_io(size_error, "truncate", path, comm)) {
+    close_files();
+    return false;
+  }
+
+  stream.frames = kept[0];
+  stream.offset = kept[1];
+
+  return true;
+}
+
+void write_delta_frame(DeltaStream &stream, usize step, const std::vector<u8> &local_bits,
+                       MPI_Comm comm) {
+  const bool key = stream.force_key || stream.since_key >= stream.keyframe_every;
+
+  // Leave room for the chunk header, which needs the size of the encoded bytes
+  auto &chunk = stream.chunk;
+  chunk.assign(sizeof(ChunkHeader), 0);
+
+  if (key) {
+    encode_zero_runs(local_bits, chunk);
+  } else {
+    for (usize i = 0; i < local_bits.size(); i++) {
+      stream.previous[i] ^= local_bits[i];
+    }
+    encode_zero_runs(stream.previous, chunk);
+  }
+
+  stream.previous = local_bits;
+
+  ChunkHeader chunk_header;
+  chunk_header.row_offset = stream.p.row_offset;
+  chunk_header.rows = stream.p.local_rows;
+  chunk_header.col_offset = stream.p.col_offset;
+  chunk_header.cols = stream.p.local_cols;
+  chunk_header.bytes = chunk.size() - sizeof(ChunkHeader);
+  std::memcpy(chunk.data(), &chunk_header, sizeof(chunk_header));
+
+  // Our chunk goes after those of the ranks before us. MPI_Exscan leaves rank 0 undefined
+  const u64 chunk_bytes = chunk.size();
+  u64 before = 0;
+  u64 total = 0;
+  MPI_Exscan(&chunk_bytes, &before, 1, MPI_UINT64_T, MPI_SUM, comm);
+  MPI_Allreduce(&chunk_bytes, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+  if (stream.p.rank == 0) {
+    before = 0;
+  }
+
+  const auto chunk_offset
+      = static_cast<MPI_Offset>(stream.offset + sizeof(StreamHeader) + before);
+  const auto count = static_cast<int>(chunk.size());
+  MPI_Status status;
+  const auto result
+      = MPI_File_write_at_all(stream.file, chunk_offset, chunk.data(), count, MPI_BYTE, &status);
+  keep_error(stream.error, write_result(result, status, MPI_BYTE, count));
+
+  const auto bytes = sizeof(StreamHeader) + total;
+
+  // The header and the index entry are tiny, so rank 0 writes them on its own
+  if (stream.p.rank == 0) {
+    int size = 0;
+    MPI_Comm_size(comm, &size);
+
+    StreamHeader header;
+    header.grid_size = stream.grid_size;
+    header.step = step;
+    header.keyframe = key ? 1 : 0;
+    header.chunks = static_cast<u64>(size);
+    header.bytes = bytes;
+
+    const auto header_result
+        = MPI_File_write_at(stream.file, static_cast<MPI_Offset>(stream.offset), &header,
+                            sizeof(header), MPI_BYTE, &status);
+    keep_error(stream.error, write_result(header_result, status, MPI_BYTE, sizeof(header)));
+
+    const IndexEntry entry{step, stream.offset, bytes, header.keyframe};
+    const auto entry_offset = static_cast<MPI_Offset>(stream.frames * sizeof(IndexEntry));
+    const auto entry_result = MPI_File_write_at(stream.index, entry_offset, &entry,
+                                                sizeof(entry), MPI_BYTE, &status);
+    keep_error(stream.error, write_result(entry_result, status, MPI_BYTE, sizeof(entry)));
+  }
+
+  stream.offset += bytes;
+  stream.frames++;
+  stream.since_key = key ? 1 : stream.since_key + 1;
+  stream.force_key = false;
+
+  stream.raw_bytes += frame_bytes(stream.grid_size);
+  stream.total_bytes += bytes;
+}
+
+void repartition_delta_stream(DeltaStream &stream, const Partition &p) {
+  stream.p = p;
+  stream.force_key = true;
+}
+
+auto close_delta_stream(DeltaStream &stream, MPI_Comm comm) -> bool {
+  keep_error(stream.error, MPI_File_close(&stream.file));
+  keep_error(stream.error, MPI_File_close(&stream.index));
+
+  if (!check_io(stream.error, "write", stream.path, comm)) {
+    return false;
+  }
+
+  // Every rank knows the sizes of all frames, so there is nothing to reduce
+  const int rank = stream.p.rank;
+
+  if (stream.total_bytes > 0) {
+    root_println("Delta stream: {} bytes instead of {} bytes of snapshots, {:.1f} times smaller",
+                 stream.total_bytes, stream.raw_bytes,
+                 static_cast<double>(stream.raw_bytes) / static_cast<double>(stream.total_bytes));
+  }
+
+  return true;
+}
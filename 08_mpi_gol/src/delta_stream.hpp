@@ -0,0 +1,111 @@
+#ifndef MPI_GOL_DELTA_STREAM_HPP
+#define MPI_GOL_DELTA_STREAM_HPP
+
+/*
+ * Snapshots as a stream of keyframes and deltas, for long runs that need the whole history.
+ *
+ * From one generation to the next only a small fraction of the cells change, and most of a grid is
+ * usually dead. So instead of every cell of every frame, the stream stores:
+ *
+ *  - keyframes, with the packed bits of the grid, every keyframe_every frames,
+ *  - delta frames in between, with the XOR of the packed bits against the previous frame. A set
+ *    bit is a cell that changed.
+ *
+ * Either way the bytes are mostly zeros, so each rank encodes its block as a sequence of
+ * (zero bytes, literal bytes) pairs: two LEB128 varints followed by the literal bytes themselves.
+ * A quiet block of a delta frame takes a few bytes, whatever its size.
+ *
+ * The encoded blocks have different sizes, so a prefix sum over the ranks gives each rank where its
+ * chunk goes in the frame, and all ranks write their chunks together. A frame is a StreamHeader
+ * followed by one chunk per rank, each being a ChunkHeader and the encoded bytes. The chunks say
+ * which block of the grid they hold, so the grid can be put back whatever the partition was.
+ *
+ * Frames have different sizes too, so rank 0 also keeps an index in a second file, one IndexEntry
+ * per frame. To get the grid of any generation, a reader looks up its frame in the index, seeks to
+ * the last keyframe before it and applies the deltas from there. plot.py shows how.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+struct StreamHeader {
+  char magic[8]{'G', 'O', 'L', 'D', 'L', 'T', 'A', '1'};
+  u64 grid_size{0}; // Number of rows and columns in the grid
+  u64 step{0};      // Generation stored in this frame
+  u64 keyframe{0};  // 1 for a keyframe, 0 for a delta against the previous frame
+  u64 chunks{0};    // Number of chunks that follow, one per rank that wrote the frame
+  u64 bytes{0};     // Size of the frame, this header included
+};
+
+static_assert(sizeof(StreamHeader) == 48, "StreamHeader must not have padding");
+
+struct ChunkHeader {
+  u64 row_offset{0}; // Global index of the first row of the block
+  u64 rows{0};       // Rows of the block
+  u64 col_offset{0}; // Global index of the first column of the block, a multiple of 8
+  u64 cols{0};       // Columns of the block
+  u64 bytes{0};      // Encoded bytes that follow
+};
+
+static_assert(sizeof(ChunkHeader) == 40, "ChunkHeader must not have padding");
+
+struct IndexEntry {
+  u64 step{0};     // Generation stored in the frame
+  u64 offset{0};   // Where the frame starts in the stream
+  u64 bytes{0};    // Size of the frame
+  u64 keyframe{0}; // 1 for a keyframe
+};
+
+static_assert(sizeof(IndexEntry) == 32, "IndexEntry must not have padding");
+
+struct DeltaStream {
+  MPI_File file{MPI_FILE_NULL};
+  MPI_File index{MPI_FILE_NULL};
+  const char *path{nullptr};
+  Partition p;
+  usize grid_size{0};
+  usize keyframe_every{0};
+  usize frames{0};    // Frames written so far
+  usize since_key{0}; // Frames written since the last keyframe
+  bool force_key{true};
+  u64 offset{0};      // End of the stream, where the next frame goes
+  u64 raw_bytes{0};   // What the frames written by this run would take as snapshots
+  u64 total_bytes{0}; // What they take in the stream
+  int error{MPI_SUCCESS}; // First MPI-IO error of this rank, if any
+
+  std::vector<u8> previous; // Our block in the previous frame
+  std::vector<u8> chunk;    // ChunkHeader and encoded bytes of the frame being written
+};
+
+/*
+ * Append to `out` the bytes of `data` as (zero bytes, literal bytes) pairs. Runs of a single zero
+ * stay in the literals, where they cost less than a new pair.
+ */
+void encode_zero_runs(const std::vector<u8> &data, std::vector<u8> &out);
+
+/*
+ * Open the stream and its index and start writing at frame `first_frame`. Any frames from that
+ * point on are dropped, and the first frame we write is a keyframe, so a restarted run continues
+ * the stream of the run it restarts. Returns false on all ranks if any rank failed.
+ */
+auto open_delta_stream(DeltaStream &stream, const char *path, const char *index_path,
+                       usize first_frame, const SimulationData &sd, const Partition &p,
+                       MPI_Comm comm) -> bool;
+
+// Append a frame. `local_bits` holds our block packed with pack_block()
+void write_delta_frame(DeltaStream &stream, usize step, const std::vector<u8> &local_bits,
+                       MPI_Comm comm);
+
+// Take the following frames from partition `p`. Our previous block is gone, so a keyframe is next
+void repartition_delta_stream(DeltaStream &stream, const Partition &p);
+
+/*
+ * Close the stream and print how much smaller it is than plain snapshots. Returns false on all
+ * ranks if any rank failed to write a frame.
+ */
+auto close_delta_stream(DeltaStream &stream, MPI_Comm comm) -> bool;
+
+#endif // MPI_GOL_DELTA_STREAM_HPP
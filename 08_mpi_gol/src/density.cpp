@@ -0,0 +1,91 @@
+#include "density.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+
+auto open_density(DensityWriter &writer, const char *path, usize first_frame,
+                  const SimulationData &sd, MPI_Comm comm) -> bool {
+  writer.path = path;
+  MPI_Comm_rank(comm, &writer.rank);
+  writer.grid_size = sd.grid_size;
+  writer.block = sd.density_block;
+  writer.map_size = density_map_size(sd.grid_size, sd.density_block);
+  writer.frames = first_frame;
+
+  const auto cells = writer.map_size * writer.map_size;
+  writer.counts.assign(cells, 0);
+
+  if (writer.rank == 0) {
+    writer.totals.assign(cells, 0);
+    writer.values.assign(cells, 0.0F);
+  }
+
+  const auto error
+      = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &writer.file);
+  if (!check_io(error, "open", path, comm)) {
+    if (writer.file != MPI_FILE_NULL) {
+      MPI_File_close(&writer.file);
+    }
+    return false;
+  }
+
+  // Drop the frames we are about to write, which a previous run may have left behind
+  const auto frame_bytes = density_frame_bytes(sd.grid_size, writer.block);
+  const auto size_error
+      = MPI_File_set_size(writer.file, static_cast<MPI_Offset>(first_frame * frame_bytes));
+  if (!check_io(size_error, "truncate", path, comm)) {
+    MPI_File_close(&writer.file);
+    return false;
+  }
+
+  return true;
+}
+
+void write_density(DensityWriter &writer, usize step, MPI_Comm comm) {
+  MPI_Reduce(writer.counts.data(), writer.totals.data(), static_cast<int>(writer.counts.size()),
+             MPI_UINT64_T, MPI_SUM, 0, comm);
+
+  // The map is small, so rank 0 writes the whole frame on its own
+  if (writer.rank == 0) {
+    const auto n = writer.map_size;
+
+    for (usize i = 0; i < n; i++) {
+      const auto rows = std::min(writer.block, writer.grid_size - i * writer.block);
+
+      for (usize j = 0; j < n; j++) {
+        const auto cols = std::min(writer.block, writer.grid_size - j * writer.block);
+        writer.values[i * n + j]
+            = static_cast<float>(static_cast<double>(writer.totals[i * n + j])
+                                 / static_cast<double>(rows * cols));
+      }
+    }
+
+    DensityHeader header;
+    header.grid_size = writer.grid_size;
+    header.step = step;
+    header.block = writer.block;
+    header.map_size = n;
+
+    const auto frame_offset = static_cast<MPI_Offset>(
+        writer.frames * density_frame_bytes(writer.grid_size, writer.block));
+
+    MPI_Status status;
+    const auto header_result = MPI_File_write_at(writer.file, frame_offset, &header,
+                                                 sizeof(header), MPI_BYTE, &status);
+    keep_error(writer.error, write_result(header_result, status, MPI_BYTE, sizeof(header)));
+
+    const auto values_offset = frame_offset + static_cast<MPI_Offset>(sizeof(header));
+    const auto count = static_cast<int>(writer.values.size());
+    const auto values_result = MPI_File_write_at(writer.file, values_offset, writer.values.data(),
+                                                 count, MPI_FLOAT, &status);
+    keep_error(writer.error, write_result(values_result, status, MPI_FLOAT, count));
+  }
+
+  writer.frames++;
+}
+
+auto close_density(DensityWriter &writer, MPI_Comm comm) -> bool {
+  keep_error(writer.error, MPI_File_close(&writer.file));
+
+  return check_io(writer.error, "write", writer.path, comm);
+}
@@ -0,0 +1,119 @@
+#ifndef MPI_GOL_DENSITY_HPP
+#define MPI_GOL_DENSITY_HPP
+
+/*
+ * Density maps: a coarse picture of the grid, for runs too large to dump cell by cell.
+ *
+ * The grid is cut into blocks of block x block cells, and the map holds the fraction of live cells
+ * of every block. The blocks of the last row and column of the map are smaller if block does not
+ * divide grid_size, and their fraction is over the cells they have. A grid of 2^20 x 2^20 cells
+ * takes 128 GiB per snapshot frame, but only 4 MiB as a map of 1024 x 1024 blocks.
+ *
+ * All maps of a run go to a single file, one frame per dump like the snapshots. A frame is a
+ * DensityHeader followed by the map_size x map_size fractions, as row major floats.
+ *
+ * Each rank counts the live cells of its block into a map of counts, which is all zeros outside
+ * the blocks of the map that overlap its rows. A reduction adds up the maps of all ranks on rank
+ * 0, which turns them into fractions and writes the frame. A block of the map may straddle the
+ * rows or columns of several ranks, and the sum takes care of that.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <algorithm>
+#include <mpi.h>
+#include <vector>
+
+struct DensityHeader {
+  char magic[8]{'G', 'O', 'L', 'D', 'E', 'N', 'S', '1'};
+  u64 grid_size{0}; // Number of rows and columns in the grid
+  u64 step{0};      // Generation stored in this frame
+  u64 block{0};     // Rows and columns of cells in a block of the map
+  u64 map_size{0};  // Number of rows and columns in the map
+};
+
+static_assert(sizeof(DensityHeader) == 40, "DensityHeader must not have padding");
+
+struct DensityWriter {
+  MPI_File file{MPI_FILE_NULL};
+  const char *path{nullptr};
+  int rank{0};
+  usize grid_size{0};
+  usize block{0};
+  usize map_size{0};
+  usize frames{0};           // Frames written so far
+  std::vector<u64> counts;   // Live cells of each block of the map, for our cells only
+  std::vector<u64> totals;   // Live cells of each block of the map, summed over all ranks
+  std::vector<float> values; // Fractions of the frame that rank 0 writes
+  int error{MPI_SUCCESS};    // First MPI-IO error of this rank, if any
+};
+
+// Blocks along a side of the map of a grid_size x grid_size grid
+constexpr auto density_map_size(usize grid_size, usize block) -> usize {
+  return (grid_size + block - 1) / block;
+}
+
+// Bytes taken by one frame of the density map
+constexpr auto density_frame_bytes(usize grid_size, usize block) -> usize {
+  const auto map_size = density_map_size(grid_size, block);
+  return sizeof(DensityHeader) + map_size * map_size * sizeof(float);
+}
+
+/*
+ * Open the density map file and start writing at frame `first_frame`, dropping any frames from
+ * that point on, like open_snapshots() does. Returns false on all ranks if any rank failed.
+ */
+auto open_density(DensityWriter &writer, const char *path, usize first_frame,
+                  const SimulationData &sd, MPI_Comm comm) -> bool;
+
+/*
+ * Count the live cells of our partition into writer.counts. `live(r, c)` is the state of data cell
+ * c of data row r of our block, both counted from 0. The rows of a block of the map go to one
+ * thread, so no two threads add to the same count.
+ */
+template <typename Live>
+void count_density(DensityWriter &writer, const Partition &p, const Live &live) {
+  std::fill(writer.counts.begin(), writer.counts.end(), u64{0});
+
+  if (p.local_rows == 0 || p.local_cols == 0) {
+    return;
+  }
+
+  const auto block = writer.block;
+  const auto map_size = writer.map_size;
+  const auto first_block = p.row_offset / block;
+  const auto last_block = (p.row_offset + p.local_rows - 1) / block;
+  auto *counts = writer.counts.data();
+
+#pragma omp parallel for default(none) schedule(static)                                            \
+    shared(p, live, block, map_size, first_block, last_block, counts)
+  for (usize b = first_block; b <= last_block; b++) {
+    // Our rows that fall in block row b of the map
+    const auto r0 = std::max(b * block, p.row_offset) - p.row_offset;
+    const auto r1 = std::min((b + 1) * block, p.row_offset + p.local_rows) - p.row_offset;
+
+    for (auto r = r0; r < r1; r++) {
+      for (usize c = 0; c < p.local_cols;) {
+        // The cells of this row up to the end of their block of the map
+        const auto global = p.col_offset + c;
+        const auto end = std::min(p.local_cols, (global / block + 1) * block - p.col_offset);
+
+        u64 sum = 0;
+        for (; c < end; c++) {
+          sum += live(r, c);
+        }
+
+        counts[b * map_size + global / block] += sum;
+      }
+    }
+  }
+}
+
+// Add up the counts of all ranks and write them as the frame of generation `step`
+void write_density(DensityWriter &writer, usize step, MPI_Comm comm);
+
+// Close the file. Returns false on all ranks if rank 0 failed to write a frame
+auto close_density(DensityWriter &writer, MPI_Comm comm) -> bool;
+
+#endif // MPI_GOL_DENSITY_HPP
@@ -0,0 +1,106 @@
+#ifndef MPI_GOL_GOL_HPP
+#define MPI_GOL_GOL_HPP
+
+/*
+ * Simulation settings and domain partitioning shared by all parts of the game of life.
+ */
+
+#include "cells.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <string>
+#include <utility>
+
+// Store simulation data
+enum IDType : int { glider_id, random_id, file_id };
+enum StorageType : int { byte_storage, packed_storage, table_storage };
+enum DecompositionType : int { row_decomposition, block_decomposition };
+enum EngineType : int { sweep_engine, hashlife_engine };
+enum HaloExchangeType : int { p2p_exchange, neighbor_exchange, rma_exchange, shared_exchange };
+
+struct SimulationData {
+  usize grid_size{32};               // Gobal grid size. The grid is always square.
+  usize generations{32};             // Numbner of generations
+  usize stats_every{1};              // Output statistics every STATS_EVERY iterations
+  usize timers_every{0};             // Also report phase timers every TIMERS_EVERY iterations
+  usize data_every{1};               // Dump data to disk every DATA_EVERY iterations
+  usize random_seed{64};             // Random seed used in initialization
+  IDType id_type{random_id};         // Type of initial data
+  std::string pattern_path;          // Pattern file of the file initial data, see pattern.hpp
+  usize pattern_row{0};              // Global row of the top left cell of the pattern
+  usize pattern_col{0};              // Global column of the top left cell of the pattern
+  StorageType storage{byte_storage}; // Cell storage: bytes, packed or packed with a lookup table
+  EngineType engine{sweep_engine};   // Sweep the grid every generation or use Hashlife
+  std::string rule_text{"B3/S23"};   // Rule of the game in B/S notation
+  MaskRule rule{ConwayRule::masks};  // The same rule as bit masks, see rules.hpp
+
+  // Split the grid in stripes of rows or in 2D blocks of a process grid
+  DecompositionType decomposition{row_decomposition};
+
+  bool sparse{false};   // Only recompute the tiles of the grid where something happens
+  usize tile_rows{16};  // Rows of a tile in sparse mode
+  usize tile_cols{256}; // Columns of a tile in sparse mode
+
+  int threads_per_rank{0}; // OpenMP threads per MPI rank. 0 lets OpenMP decide
+  int ranks_per_node{0};   // Expected MPI ranks per node. 0 skips the check
+  usize halo_depth{1};     // Halo rows exchanged at once, and generations between exchanges
+
+  // Point to point messages, a neighbourhood collective, one sided puts or shared memory
+  HaloExchangeType halo_exchange{p2p_exchange};
+
+  usize balance_every{0};        // Rebalance rows every BALANCE_EVERY iterations. 0 disables it
+  double balance_tolerance{0.05}; // Imbalance of the slowest rank over the mean that we accept
+
+  bool async_output{true}; // Write snapshots with nonblocking collective MPI-IO
+  usize queue_depth{2};    // Staging buffers, i.e. snapshot frames in flight at once
+  usize density_block{0};  // Write maps of the live fraction of blocks this wide, not snapshots
+  usize keyframe_every{0}; // Write a delta stream with a keyframe this often, not snapshots
+
+  usize checkpoint_every{0}; // Checkpoint every CHECKPOINT_EVERY iterations. 0 disables them
+  std::string restart_from;  // Checkpoint to restart from. Empty for a fresh start
+  usize first_step{0};       // First generation to compute, which is not 0 after a restart
+
+  // Where checkpoints are written
+  std::string checkpoint_path{"gol_checkpoint.bin"};
+
+  usize scaling_repeats{5}; // Timed runs per number of ranks in the scaling mode
+  bool quiet{false};        // No statistics, reports or output files, for the scaling trials
+};
+
+// Compute local stripe partitioning (rows per rank)
+struct Partition {
+  int rank{0};         // Rank that owns the partition
+  int size{0};         // Total number of ranks
+  usize local_rows{0}; // Number of data rows (excluding halo rows)
+  usize row_offset{0}; // Global index of the first row owned by this rank.
+  usize local_cols{0}; // Number of data columns (excluding halo columns)
+  usize col_offset{0}; // Global index of the first column owned by this rank.
+};
+
+/*
+ * Split `extent` cells among `parts` ranks. Returns the number of cells and the global index of the
+ * first cell owned by part `index`.
+ */
+inline auto split_extent(usize extent, int parts, int index) -> std::pair<usize, usize> {
+  /*
+   * To allow for grid_size be divisible by size, we will use the same trick we used in the first
+   * OpenMP parallelization example and distribuite the cell remainder across ranks allow
+   * sd.grid_size not
+   */
+  const auto base = extent / static_cast<usize>(parts);
+  const auto rem = extent % static_cast<usize>(parts);
+
+  const auto local = base + (static_cast<usize>(index) < rem ? 1 : 0);
+  const auto offset = base * static_cast<usize>(index) + std::min(static_cast<usize>(index), rem);
+
+  return {local, offset};
+}
+
+// Print only on rank zero
+#define root_println(format, ...)                                                                  \
+  if (rank == 0) {                                                                                 \
+    fmt::println(format __VA_OPT__(, ) __VA_ARGS__);                                               \
+  }
+
+#endif // MPI_GOL_GOL_HPP
@@ -0,0 +1,606 @@
+#ifndef MPI_GOL_HALO_HPP
+#define MPI_GOL_HALO_HPP
+
+/*
+ * Halo exchange of the row and 2D block decompositions.
+ *
+ * The simulation sets up persistent point to point requests once (see init_row_halos() and
+ * init_block_halos()) and starts them every time it needs fresh halos. Alternatively the whole
+ * exchange is a single neighbourhood collective on a graph communicator of our neighbours (see
+ * NeighborHalo), or a set of one sided puts into the halos of our neighbours (see RmaHalo). Ranks
+ * on the same node can also skip the exchange and read each other's rows (see SharedHalo).
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mpi.h>
+#include <vector>
+
+// Get a pointer to the start of a row. MPI needs this
+template <typename word>
+inline auto row_ptr(word *data_ptr, usize row_words, usize r) -> word * {
+  return data_ptr + (r * row_words);
+}
+
+/*
+ * Halo exchange for the 2D block decomposition. Each rank talks to its 8 neighbours in the
+ * process grid: 4 edges and 4 corners. Every halo region, and every region of data we send, is
+ * described by an MPI subarray datatype of the local buffer, so columns (which are strided in
+ * memory) go out without us packing them by hand.
+ *
+ * Directions are numbered so that the opposite of direction d is 7 - d. A message travelling in
+ * direction d is tagged with d, which keeps messages apart even when the same rank is our
+ * neighbour in more than one direction (e.g. on a 2 x 2 process grid).
+ */
+struct BlockHalo {
+  static constexpr int directions[8][2]
+      = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+
+  int neighbour[8]{};          // Rank of the neighbour in each direction
+  MPI_Datatype send_type[8]{}; // Data cells we send to the neighbour in each direction
+  MPI_Datatype recv_type[8]{}; // Halo cells we receive from the neighbour in each direction
+};
+
+inline auto make_block_halo(MPI_Comm cart_comm, const Partition &p, MPI_Datatype cell_type)
+    -> BlockHalo {
+  BlockHalo halo;
+
+  int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2] = {0, 0};
+  MPI_Cart_get(cart_comm, 2, dims, periods, coords);
+
+  const int sizes[2] = {static_cast<int>(p.local_rows + 2), static_cast<int>(p.local_cols + 2)};
+  const int local[2] = {static_cast<int>(p.local_rows), static_cast<int>(p.local_cols)};
+
+  for (int d = 0; d < 8; d++) {
+    int subsizes[2] = {0, 0}, send_starts[2] = {0, 0}, recv_starts[2] = {0, 0}, where[2] = {0, 0};
+
+    for (int i = 0; i < 2; i++) {
+      const auto offset = BlockHalo::directions[d][i];
+
+      // Periodic dimensions wrap around, so MPI_Cart_rank accepts coordinates out of range
+      where[i] = coords[i] + offset;
+
+      // Along an axis we either take the whole data range, or the single layer next to the edge
+      subsizes[i] = (offset == 0) ? local[i] : 1;
+      send_starts[i] = (offset == 1) ? local[i] : 1;
+      recv_starts[i] = (offset == -1) ? 0 : ((offset == 1) ? local[i] + 1 : 1);
+    }
+
+    MPI_Cart_rank(cart_comm, where, &halo.neighbour[d]);
+
+    MPI_Type_create_subarray(2, sizes, subsizes, send_starts, MPI_ORDER_C, cell_type,
+                             &halo.send_type[d]);
+    MPI_Type_commit(&halo.send_type[d]);
+
+    MPI_Type_create_subarray(2, sizes, subsizes, recv_starts, MPI_ORDER_C, cell_type,
+                             &halo.recv_type[d]);
+    MPI_Type_commit(&halo.recv_type[d]);
+  }
+
+  return halo;
+}
+
+inline void free_block_halo(BlockHalo &halo) {
+  for (int d = 0; d < 8; d++) {
+    MPI_Type_free(&halo.send_type[d]);
+    MPI_Type_free(&halo.recv_type[d]);
+  }
+}
+
+/*
+ * Set up persistent receives and sends for the 2D halo exchange of buffer `buf`. We receive all 8
+ * halo regions and send our 8 edge regions. Returns the number of requests written to reqs.
+ *
+ * If `empty_sends` is not null, it gets a zero length version of each send, which sparse mode
+ * posts instead of the real one when the region did not change (see tiles.hpp).
+ */
+template <typename word>
+auto init_block_halos(word *buf, const BlockHalo &halo, MPI_Comm comm, MPI_Request *reqs,
+                      MPI_Request *empty_sends) -> int {
+  for (int d = 0; d < 8; d++) {
+    MPI_Recv_init(buf, 1, halo.recv_type[d], halo.neighbour[d], 7 - d, comm, &reqs[d]);
+  }
+
+  for (int d = 0; d < 8; d++) {
+    MPI_Send_init(buf, 1, halo.send_type[d], halo.neighbour[d], d, comm, &reqs[8 + d]);
+
+    if (empty_sends != nullptr) {
+      MPI_Send_init(buf, 0, halo.send_type[d], halo.neighbour[d], d, comm, &empty_sends[d]);
+    }
+  }
+
+  return 16;
+}
+
+// Where the halos and the sent rows of the row decomposition are, in the order of init_row_halos()
+struct RowHalo {
+  static constexpr int recv_directions[2][2] = {{-1, 0}, {1, 0}};
+  static constexpr int send_directions[2][2] = {{1, 0}, {-1, 0}};
+};
+
+/*
+ * Set up persistent receives and sends for the halo exchange of buffer `buf` with the neighbours
+ * 'up' and 'down' of the row decomposition. Returns the number of requests written to reqs.
+ * `empty_sends` works as for init_block_halos().
+ *
+ * Each message carries `depth` rows. Rows are counted from the start of the buffer, so with deep
+ * halos the top halo is rows 0..depth-1, our data rows are depth..depth+local_rows-1 and the bottom
+ * halo follows them. With depth 1 this is the usual layout.
+ */
+template <typename word>
+auto init_row_halos(word *buf, usize row_words, usize depth, const Partition &p,
+                    MPI_Datatype row_type, int up, int down, MPI_Comm comm, MPI_Request *reqs,
+                    MPI_Request *empty_sends) -> int {
+  const auto row_count = static_cast<int>(depth * row_words);
+
+  /*
+   * Receives for halos:
+   * Receive top halo (row 0) from neighbor 'up' (they will send their bottom data row)
+   * Receive bottom halo (row local_rows + 1) from neighbor 'down' (they will send their top data
+   * row).
+   */
+  MPI_Recv_init(row_ptr(buf, row_words, 0), row_count, row_type, up, 0, comm, &reqs[0]);
+  MPI_Recv_init(row_ptr(buf, row_words, depth + p.local_rows), row_count, row_type, down, 1, comm,
+                &reqs[1]);
+
+  /*
+   * Sends for the rows we have and our neighbours will need.
+   * Send our bottom data row (row p.local_rows) to 'down' with tag 0 (so that down receives into
+   * its top halo)
+   * Send our top real row (row 1) to 'up' with tag 1 (so that up receives into its bottom halo)
+   */
+  MPI_Send_init(row_ptr(buf, row_words, p.local_rows), row_count, row_type, down, 0, comm,
+                &reqs[2]);
+  MPI_Send_init(row_ptr(buf, row_words, depth), row_count, row_type, up, 1, comm, &reqs[3]);
+
+  if (empty_sends != nullptr) {
+    MPI_Send_init(row_ptr(buf, row_words, p.local_rows), 0, row_type, down, 0, comm,
+                  &empty_sends[0]);
+    MPI_Send_init(row_ptr(buf, row_words, depth), 0, row_type, up, 1, comm, &empty_sends[1]);
+  }
+
+  return 4;
+}
+
+/*
+ * The same exchanges as a single neighbourhood collective. We describe who our neighbours are once,
+ * as a distributed graph communicator, and every exchange is then one MPI_Ineighbor_alltoallw call
+ * instead of a receive and a send per neighbour. Knowing the whole pattern at once lets the library
+ * pick how to schedule the messages, and on some networks map them to the topology.
+ *
+ * Block i of the exchange is received from sources[i] and block i sent to destinations[i]. When the
+ * same rank is our neighbour along several edges (with 1 or 2 ranks along a dimension), the blocks
+ * between the two of us are matched in order. So we list the sources in the order of the halo
+ * directions, and the destinations in the order of the opposite directions: the i-th block a rank
+ * sends is the one its i-th source neighbour expects.
+ *
+ * There is no status per message, so sparse mode, which tells quiet regions apart by their empty
+ * messages, needs the point to point exchange. MPI 4 would let us make the collective persistent
+ * with MPI_Neighbor_alltoallw_init, but the non-blocking version is what MPI 3 has.
+ */
+struct NeighborHalo {
+  MPI_Comm comm{MPI_COMM_NULL}; // Graph of our neighbours
+  int blocks{0};                // Blocks sent and received, one per edge of the graph
+
+  // Where each block lives, in bytes from the start of the buffer, and how it is laid out
+  int send_counts[8]{};
+  int recv_counts[8]{};
+  MPI_Aint send_displs[8]{};
+  MPI_Aint recv_displs[8]{};
+  MPI_Datatype send_types[8]{};
+  MPI_Datatype recv_types[8]{};
+};
+
+inline auto make_neighbor_comm(MPI_Comm comm, const int *sources, const int *destinations,
+                               int blocks) -> MPI_Comm {
+  MPI_Comm graph = MPI_COMM_NULL;
+  MPI_Dist_graph_create_adjacent(comm, blocks, sources, MPI_UNWEIGHTED, blocks, destinations,
+                                 MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &graph);
+  return graph;
+}
+
+/*
+ * Neighbourhood exchange of the row decomposition, with the same buffer layout and messages as
+ * init_row_halos().
+ */
+template <typename word>
+auto make_row_neighbor_halo(usize row_words, usize depth, const Partition &p, MPI_Datatype row_type,
+                            int up, int down, MPI_Comm comm) -> NeighborHalo {
+  NeighborHalo halo;
+  halo.blocks = 2;
+
+  const int sources[2] = {up, down};
+  const int destinations[2] = {down, up};
+  halo.comm = make_neighbor_comm(comm, sources, destinations, halo.blocks);
+
+  const auto row_bytes = static_cast<MPI_Aint>(row_words * sizeof(word));
+  const auto row = [&](usize r) { return static_cast<MPI_Aint>(r) * row_bytes; };
+
+  for (int i = 0; i < 2; i++) {
+    halo.send_counts[i] = static_cast<int>(depth * row_words);
+    halo.recv_counts[i] = static_cast<int>(depth * row_words);
+    halo.send_types[i] = row_type;
+    halo.recv_types[i] = row_type;
+  }
+
+  // Halo from up on top and from down at the bottom. Our bottom rows go down, our top rows up.
+  halo.recv_displs[0] = row(0);
+  halo.recv_displs[1] = row(depth + p.local_rows);
+  halo.send_displs[0] = row(p.local_rows);
+  halo.send_displs[1] = row(depth);
+
+  return halo;
+}
+
+// Neighbourhood exchange of the 2D block decomposition, with the regions of `block_halo`
+inline auto make_block_neighbor_halo(const BlockHalo &block_halo, MPI_Comm comm) -> NeighborHalo {
+  NeighborHalo halo;
+  halo.blocks = 8;
+
+  int sources[8], destinations[8];
+
+  for (int d = 0; d < 8; d++) {
+    sources[d] = block_halo.neighbour[d];
+    destinations[d] = block_halo.neighbour[7 - d];
+
+    halo.recv_counts[d] = 1;
+    halo.recv_types[d] = block_halo.recv_type[d];
+    halo.send_counts[d] = 1;
+    halo.send_types[d] = block_halo.send_type[7 - d];
+  }
+
+  halo.comm = make_neighbor_comm(comm, sources, destinations, halo.blocks);
+
+  return halo;
+}
+
+inline void free_neighbor_halo(NeighborHalo &halo) {
+  if (halo.comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&halo.comm);
+  }
+}
+
+/*
+ * Start the exchange of the halos of `buf`. The regions we send and those we receive never
+ * overlap, so the same buffer is both the send and the receive buffer.
+ */
+template <typename word>
+void start_neighbor_halo(word *buf, const NeighborHalo &halo, MPI_Request *request) {
+  MPI_Ineighbor_alltoallw(buf, halo.send_counts, halo.send_displs, halo.send_types, buf,
+                          halo.recv_counts, halo.recv_displs, halo.recv_types, halo.comm, request);
+}
+
+/*
+ * The same exchanges with one sided communication. Each of the two buffers is exposed in an MPI
+ * window, and instead of matching receives with sends, every rank puts its boundary regions
+ * straight into the halos of its neighbours. On networks with RDMA a put goes to the remote memory
+ * without the tag matching and rendezvous handshake of large two sided messages.
+ *
+ * The puts are synchronized with post, start, complete and wait (PSCW), which only involves the
+ * ranks that actually talk to each other:
+ *
+ *  - MPI_Win_post opens our window to our neighbours. We only do it once we are done with the last
+ *    generation, so nothing can land in our halos while we still read them.
+ *  - MPI_Win_start, the puts and MPI_Win_complete write our regions into the neighbours' halos.
+ *  - MPI_Win_test / MPI_Win_wait tell us when all neighbours completed their puts to us.
+ *
+ * A put has to say where in the target's buffer the data goes, and our neighbours may own a
+ * different number of rows or columns than we do. So we gather the sizes of all partitions once
+ * and describe every region with the target's layout. Sparse mode needs the empty messages of the
+ * point to point exchange, so it does not work with this backend.
+ */
+struct RmaHalo {
+  MPI_Win win[2]{MPI_WIN_NULL, MPI_WIN_NULL}; // One window per buffer, like the request sets
+  MPI_Group group{MPI_GROUP_NULL};            // Our neighbours, each of them once
+  int puts{0};                                // Regions we put, one per edge to a neighbour
+
+  int target[8]{}; // Rank we put each region to
+
+  // Where each region is in our buffer and in the target's buffer, in words
+  MPI_Aint origin_disp[8]{};
+  MPI_Aint target_disp[8]{};
+  int count[8]{};
+  MPI_Datatype origin_type[8]{};
+  MPI_Datatype target_type[8]{};
+  bool own_types{false}; // Whether target_type holds types we have to free
+};
+
+// Group of the ranks in `ranks`, which may repeat
+inline auto make_neighbor_group(MPI_Comm comm, const int *ranks, int n) -> MPI_Group {
+  int unique[8], count = 0;
+  for (int i = 0; i < n; i++) {
+    if (std::find(unique, unique + count, ranks[i]) == unique + count) {
+      unique[count++] = ranks[i];
+    }
+  }
+
+  MPI_Group all = MPI_GROUP_NULL, group = MPI_GROUP_NULL;
+  MPI_Comm_group(comm, &all);
+  MPI_Group_incl(all, count, unique, &group);
+  MPI_Group_free(&all);
+
+  return group;
+}
+
+// Expose both buffers, each `words` words long
+template <typename word>
+void create_rma_windows(RmaHalo &halo, word *const *bufs, usize words, MPI_Comm comm) {
+  for (int parity = 0; parity < 2; parity++) {
+    MPI_Win_create(bufs[parity], static_cast<MPI_Aint>(words * sizeof(word)),
+                   static_cast<int>(sizeof(word)), MPI_INFO_NULL, comm, &halo.win[parity]);
+  }
+}
+
+/*
+ * One sided exchange of the row decomposition, with the same buffer layout and messages as
+ * init_row_halos(). `bufs` are the two buffers, of `words` words each.
+ */
+template <typename word>
+auto make_row_rma_halo(word *const *bufs, usize words, usize row_words, usize depth,
+                       const Partition &p, MPI_Datatype row_type, int up, int down, MPI_Comm comm)
+    -> RmaHalo {
+  RmaHalo halo;
+  halo.puts = 2;
+
+  // The bottom halo of rank `up` starts right after its data rows
+  const auto local_rows = static_cast<u64>(p.local_rows);
+  std::vector<u64> rows(static_cast<usize>(p.size));
+  MPI_Allgather(&local_rows, 1, MPI_UINT64_T, rows.data(), 1, MPI_UINT64_T, comm);
+
+  const auto row = [&](usize r) { return static_cast<MPI_Aint>(r * row_words); };
+
+  // Our bottom rows into the top halo of down, our top rows into the bottom halo of up
+  halo.target[0] = down;
+  halo.origin_disp[0] = row(p.local_rows);
+  halo.target_disp[0] = row(0);
+
+  halo.target[1] = up;
+  halo.origin_disp[1] = row(depth);
+  halo.target_disp[1] = row(depth + rows[static_cast<usize>(up)]);
+
+  for (int i = 0; i < 2; i++) {
+    halo.count[i] = static_cast<int>(depth * row_words);
+    halo.origin_type[i] = row_type;
+    halo.target_type[i] = row_type;
+  }
+
+  halo.group = make_neighbor_group(comm, halo.target, halo.puts);
+  create_rma_windows(halo, bufs, words, comm);
+
+  return halo;
+}
+
+/*
+ * One sided exchange of the 2D block decomposition. We put the region that block_halo sends in
+ * direction d into the halo of the neighbour in direction d, which is its halo on the opposite
+ * side, 7 - d.
+ */
+template <typename word>
+auto make_block_rma_halo(word *const *bufs, usize words, const BlockHalo &block_halo,
+                         const Partition &p, MPI_Datatype cell_type, MPI_Comm comm) -> RmaHalo {
+  RmaHalo halo;
+  halo.puts = 8;
+  halo.own_types = true;
+
+  const u64 local[2] = {static_cast<u64>(p.local_rows), static_cast<u64>(p.local_cols)};
+  std::vector<u64> sizes(2 * static_cast<usize>(p.size));
+  MPI_Allgather(local, 2, MPI_UINT64_T, sizes.data(), 2, MPI_UINT64_T, comm);
+
+  for (int d = 0; d < 8; d++) {
+    const auto other = static_cast<usize>(block_halo.neighbour[d]);
+    const int theirs[2]
+        = {static_cast<int>(sizes[2 * other]), static_cast<int>(sizes[2 * other + 1])};
+    const int buffer[2] = {theirs[0] + 2, theirs[1] + 2};
+
+    int subsizes[2] = {0, 0}, starts[2] = {0, 0};
+    for (int i = 0; i < 2; i++) {
+      // The halo on side 7 - d of the target, laid out as in make_block_halo()
+      const auto offset = BlockHalo::directions[7 - d][i];
+      subsizes[i] = (offset == 0) ? theirs[i] : 1;
+      starts[i] = (offset == -1) ? 0 : ((offset == 1) ? theirs[i] + 1 : 1);
+    }
+
+    MPI_Type_create_subarray(2, buffer, subsizes, starts, MPI_ORDER_C, cell_type,
+                             &halo.target_type[d]);
+    MPI_Type_commit(&halo.target_type[d]);
+
+    halo.target[d] = block_halo.neighbour[d];
+    halo.count[d] = 1;
+    halo.origin_type[d] = block_halo.send_type[d];
+  }
+
+  halo.group = make_neighbor_group(comm, halo.target, halo.puts);
+  create_rma_windows(halo, bufs, words, comm);
+
+  return halo;
+}
+
+inline void free_rma_halo(RmaHalo &halo) {
+  for (auto &win : halo.win) {
+    if (win != MPI_WIN_NULL) {
+      MPI_Win_free(&win);
+    }
+  }
+
+  if (halo.group != MPI_GROUP_NULL) {
+    MPI_Group_free(&halo.group);
+  }
+
+  if (halo.own_types) {
+    for (int i = 0; i < halo.puts; i++) {
+      MPI_Type_free(&halo.target_type[i]);
+    }
+  }
+}
+
+/*
+ * Put our regions of buffer `buf` into the window `parity` of our neighbours, which is the one of
+ * the buffer that holds their state for the same generation. Returns once our puts are done on our
+ * side, so the halos may still be on their way.
+ */
+template <typename word> void start_rma_halo(word *buf, const RmaHalo &halo, int parity) {
+  const auto win = halo.win[parity];
+
+  MPI_Win_post(halo.group, 0, win);
+  MPI_Win_start(halo.group, 0, win);
+
+  for (int i = 0; i < halo.puts; i++) {
+    MPI_Put(buf + halo.origin_disp[i], halo.count[i], halo.origin_type[i], halo.target[i],
+            halo.target_disp[i], halo.count[i], halo.target_type[i], win);
+  }
+
+  MPI_Win_complete(win);
+}
+
+/*
+ * Halo exchange without copies between ranks on the same node, for the row decomposition.
+ *
+ * The ranks of a node allocate their two buffers in one shared memory window, so each of them can
+ * read the rows of the others directly. A neighbour on our node never sends us its boundary row:
+ * when we compute our first or last data row, the kernel reads the row above or below straight
+ * from the neighbour's buffer. Only neighbours on other nodes go through messages.
+ *
+ * What is left is to agree on when a row can be read. Every rank keeps a counter in front of its
+ * buffers with the generation it holds, plus one so that 0 means none yet. Before we compute our
+ * boundary rows of generation g + 1 we wait for our neighbours to hold generation g. This covers
+ * both sides:
+ *
+ *  - the rows we read hold generation g, and
+ *  - the neighbours are done with generation g - 1, which they read from the buffer we are about
+ *    to write our new boundary rows to.
+ *
+ * Our interior rows are not read by anyone, so they are computed without waiting, as with messages
+ * in flight. Each rank is at most one generation ahead of its neighbours, and its interior rows
+ * are never the rows they read.
+ */
+template <typename word> struct SharedHalo {
+  MPI_Comm node_comm{MPI_COMM_NULL}; // Ranks on our node
+  MPI_Win win{MPI_WIN_NULL};         // The buffers of all ranks of the node
+  u64 *ready{nullptr};               // Generation we hold plus one, read by our neighbours
+  word *bufs[2]{};                   // Our two buffers, in the window
+
+  // Neighbour up (0) and down (1): whether it is on our node, its counter and the row we read
+  bool on_node[2]{};
+  u64 *their_ready[2]{};
+  const word *their_row[2][2]{}; // Per neighbour and buffer parity
+};
+
+// The counter goes before the buffers, on a cache line of its own
+inline constexpr usize shared_header_bytes = 64;
+
+/*
+ * Allocate the window for two buffers of `words` words on each rank of our node. The window is
+ * not contiguous, so each rank's part can be placed on its own NUMA domain.
+ */
+template <typename word> auto make_shared_halo(usize words, MPI_Comm comm) -> SharedHalo<word> {
+  SharedHalo<word> halo;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &halo.node_comm);
+
+  MPI_Info info = MPI_INFO_NULL;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+
+  std::byte *base = nullptr;
+  const auto bytes = static_cast<MPI_Aint>(shared_header_bytes + 2 * words * sizeof(word));
+  MPI_Win_allocate_shared(bytes, 1, info, halo.node_comm, &base, &halo.win);
+  MPI_Info_free(&info);
+
+  halo.ready = reinterpret_cast<u64 *>(base);
+  *halo.ready = 0;
+
+  halo.bufs[0] = reinterpret_cast<word *>(base + shared_header_bytes);
+  halo.bufs[1] = halo.bufs[0] + words;
+
+  // A passive epoch for the whole run, which lets us sync the window with MPI_Win_sync
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, halo.win);
+
+  return halo;
+}
+
+/*
+ * Find the neighbours `up` and `down` (ranks in `comm`) on our node, and the rows of their buffers
+ * we read as our halos: the last data row of up and the first data row of down. The window may
+ * round the size of each part up, so we gather how many rows each rank owns.
+ */
+template <typename word>
+void connect_shared_halo(SharedHalo<word> &halo, usize row_words, const Partition &p, int up,
+                         int down, MPI_Comm comm) {
+  const auto local_rows = static_cast<u64>(p.local_rows);
+  std::vector<u64> rows(static_cast<usize>(p.size));
+  MPI_Allgather(&local_rows, 1, MPI_UINT64_T, rows.data(), 1, MPI_UINT64_T, comm);
+
+  MPI_Group group = MPI_GROUP_NULL, node_group = MPI_GROUP_NULL;
+  MPI_Comm_group(comm, &group);
+  MPI_Comm_group(halo.node_comm, &node_group);
+
+  const int neighbours[2] = {up, down};
+  int node_ranks[2] = {MPI_UNDEFINED, MPI_UNDEFINED};
+  MPI_Group_translate_ranks(group, 2, neighbours, node_group, node_ranks);
+
+  MPI_Group_free(&group);
+  MPI_Group_free(&node_group);
+
+  for (int i = 0; i < 2; i++) {
+    halo.on_node[i] = (node_ranks[i] != MPI_UNDEFINED);
+    if (!halo.on_node[i]) {
+      continue;
+    }
+
+    MPI_Aint bytes = 0;
+    int unit = 0;
+    std::byte *base = nullptr;
+    MPI_Win_shared_query(halo.win, node_ranks[i], &bytes, &unit, &base);
+
+    const auto their_rows = rows[static_cast<usize>(neighbours[i])];
+    const auto words = (their_rows + 2) * row_words;
+    const auto row = (i == 0) ? their_rows : 1;
+
+    halo.their_ready[i] = reinterpret_cast<u64 *>(base);
+    for (usize parity = 0; parity < 2; parity++) {
+      halo.their_row[i][parity]
+          = reinterpret_cast<const word *>(base + shared_header_bytes) + parity * words
+            + row * row_words;
+    }
+  }
+
+  // Nobody may look at a counter before its owner cleared it
+  MPI_Win_sync(halo.win);
+  MPI_Barrier(halo.node_comm);
+}
+
+template <typename word> void free_shared_halo(SharedHalo<word> &halo) {
+  if (halo.win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(halo.win);
+    MPI_Win_free(&halo.win);
+    MPI_Comm_free(&halo.node_comm);
+  }
+}
+
+// Tell our neighbours that our current buffer holds generation `step`
+template <typename word> void publish_generation(const SharedHalo<word> &halo, usize step) {
+  MPI_Win_sync(halo.win);
+  std::atomic_ref<u64>(*halo.ready).store(step + 1, std::memory_order_release);
+}
+
+// Whether our neighbours on this node hold generation `step` or a later one
+template <typename word> auto neighbours_ready(const SharedHalo<word> &halo, usize step) -> bool {
+  for (int i = 0; i < 2; i++) {
+    if (!halo.on_node[i]) {
+      continue;
+    }
+
+    const auto theirs = std::atomic_ref<u64>(*halo.their_ready[i]).load(std::memory_order_acquire);
+    if (theirs < step + 1) {
+      return false;
+    }
+  }
+
+  MPI_Win_sync(halo.win);
+  return true;
+}
+
+#endif // MPI_GOL_HALO_HPP
@@ -0,0 +1,311 @@
+/*
+ * Benchmark of the halo exchange backends of halo.hpp.
+ *
+ * Usage: mpirun -np N gol_halo_bench [grid_size] [exchanges] [halo_depth]
+ *
+ * For the row decomposition and for the 2D block decomposition, we split a grid_size x grid_size
+ * grid of byte cells among the ranks and time `exchanges` halo exchanges with each backend:
+ *
+ *  - p2p:      the persistent MPI_Recv_init / MPI_Send_init requests the simulation uses by default
+ *  - neighbor: one MPI_Ineighbor_alltoallw on a graph communicator of the neighbours
+ *  - rma:      MPI_Put into windows of the neighbours, synchronized with post/start/complete/wait.
+ *              It needs at least 2 ranks, see RmaHalo in halo.hpp.
+ *
+ * We report the mean time per exchange of the slowest rank. Only the rows carry halo_depth rows per
+ * message. Every cell holds a value computed from its global position, so after the exchanges we
+ * check that each backend filled the halos with the cells of the right neighbours.
+ */
+
+#include "halo.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <mpi.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Value of the global cell r, c, which we can tell apart from most other cells
+static auto cell_value(usize r, usize c, usize grid_size) -> u8 {
+  return static_cast<u8>(((r % grid_size) * 31 + (c % grid_size) * 7) % 251);
+}
+
+/*
+ * Time `exchanges` calls of `exchange` after a warm up one. Returns the mean time per exchange of
+ * the slowest rank in microseconds.
+ */
+template <typename Exchange>
+static auto time_exchanges(usize exchanges, MPI_Comm comm, Exchange exchange) -> double {
+  exchange();
+
+  MPI_Barrier(comm);
+  const auto start = std::chrono::steady_clock::now();
+
+  for (usize i = 0; i < exchanges; i++) {
+    exchange();
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+
+  const auto local = std::chrono::duration<double, std::micro>(end - start).count()
+                     / static_cast<double>(exchanges);
+  double slowest = 0.0;
+  MPI_Allreduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  return slowest;
+}
+
+/*
+ * Time the one sided exchange of a copy of `initial`. `make(bufs, words)` sets it up for the two
+ * buffers of `words` words in bufs, of which we use the first. Returns the time per exchange, or a
+ * negative time with a single rank. `ok` tells whether `check` liked the halos.
+ */
+template <typename Make, typename Check>
+static auto time_rma(const std::vector<u8> &initial, usize exchanges, MPI_Comm comm, Make make,
+                     Check check, bool &ok) -> double {
+  int size = 0;
+  MPI_Comm_size(comm, &size);
+
+  ok = true;
+  if (size == 1) {
+    return -1.0;
+  }
+
+  auto buf = initial, other = initial;
+  u8 *bufs[2] = {buf.data(), other.data()};
+  auto halo = make(bufs, buf.size());
+
+  const auto us = time_exchanges(exchanges, comm, [&] {
+    start_rma_halo(buf.data(), halo, 0);
+    MPI_Win_wait(halo.win[0]);
+  });
+
+  ok = check(buf);
+  free_rma_halo(halo);
+
+  return us;
+}
+
+// The times of the three backends on a line
+static auto format_times(double p2p_us, double neighbor_us, double rma_us) -> std::string {
+  const auto rma
+      = (rma_us < 0.0) ? fmt::format("{:>13}", "-") : fmt::format("{:>10.2f} us", rma_us);
+  return fmt::format("{:>10.2f} us p2p {:>10.2f} us neighbor {} rma", p2p_us, neighbor_us, rma);
+}
+
+// Whether every rank found the halos it expected
+static auto all_ok(bool ok, MPI_Comm comm) -> bool {
+  int local = ok ? 1 : 0, all = 0;
+  MPI_Allreduce(&local, &all, 1, MPI_INT, MPI_LAND, comm);
+  return all != 0;
+}
+
+// Rows of the row decomposition. Returns false if a backend got the halos wrong.
+static auto bench_rows(usize grid_size, usize exchanges, usize depth, MPI_Comm comm) -> bool {
+  int rank = 0, size = 0;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  const auto [local_rows, row_offset] = split_extent(grid_size, size, rank);
+  const Partition p{rank, size, local_rows, row_offset, grid_size, 0};
+
+  const int up = (rank - 1 + size) % size;
+  const int down = (rank + 1) % size;
+  const auto row_words = grid_size;
+  const auto rows = local_rows + 2 * depth;
+
+  // Buffer row b holds global row row_offset + b - depth, which wraps around for the halos
+  const auto global_row = [&](usize b) { return row_offset + grid_size * depth + b - depth; };
+
+  const auto fill = [&](std::vector<u8> &buf) {
+    buf.assign(rows * row_words, 0);
+    for (usize b = depth; b < depth + local_rows; b++) {
+      for (usize c = 0; c < row_words; c++) {
+        buf[b * row_words + c] = cell_value(global_row(b), c, grid_size);
+      }
+    }
+  };
+
+  const auto check = [&](const std::vector<u8> &buf) {
+    bool ok = true;
+    for (usize b = 0; b < rows; b++) {
+      for (usize c = 0; c < row_words; c++) {
+        ok = ok && buf[b * row_words + c] == cell_value(global_row(b), c, grid_size);
+      }
+    }
+    return ok;
+  };
+
+  std::vector<u8> p2p_buf, neighbor_buf, rma_buf;
+  fill(p2p_buf);
+  fill(neighbor_buf);
+  fill(rma_buf);
+
+  MPI_Request reqs[4];
+  const auto num_reqs = init_row_halos(p2p_buf.data(), row_words, depth, p, MPI_UNSIGNED_CHAR, up,
+                                       down, comm, reqs, nullptr);
+  auto neighbor_halo
+      = make_row_neighbor_halo<u8>(row_words, depth, p, MPI_UNSIGNED_CHAR, up, down, comm);
+
+  const auto p2p_us = time_exchanges(exchanges, comm, [&] {
+    MPI_Startall(num_reqs, reqs);
+    MPI_Waitall(num_reqs, reqs, MPI_STATUSES_IGNORE);
+  });
+
+  const auto neighbor_us = time_exchanges(exchanges, comm, [&] {
+    MPI_Request request = MPI_REQUEST_NULL;
+    start_neighbor_halo(neighbor_buf.data(), neighbor_halo, &request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+  });
+
+  bool rma_ok = true;
+  const auto rma_us = time_rma(
+      rma_buf, exchanges, comm,
+      [&](u8 *const *bufs, usize words) {
+        return make_row_rma_halo(bufs, words, row_words, depth, p, MPI_UNSIGNED_CHAR, up, down,
+                                 comm);
+      },
+      check, rma_ok);
+
+  const auto ok = all_ok(check(p2p_buf) && check(neighbor_buf) && rma_ok, comm);
+
+  if (rank == 0) {
+    fmt::println("rows     {:>4} ranks {:>6} depth {}", size, depth,
+                 format_times(p2p_us, neighbor_us, rma_us));
+  }
+
+  for (int i = 0; i < num_reqs; i++) {
+    MPI_Request_free(&reqs[i]);
+  }
+  free_neighbor_halo(neighbor_halo);
+
+  return ok;
+}
+
+// Blocks of the 2D block decomposition. Returns false if a backend got the halos wrong.
+static auto bench_blocks(usize grid_size, usize exchanges, MPI_Comm comm) -> bool {
+  int size = 0;
+  MPI_Comm_size(comm, &size);
+
+  int dims[2] = {0, 0};
+  const int periods[2] = {1, 1};
+  MPI_Dims_create(size, 2, dims);
+
+  MPI_Comm cart_comm = MPI_COMM_NULL;
+  MPI_Cart_create(comm, 2, dims, periods, 0, &cart_comm);
+
+  int rank = 0, coords[2] = {0, 0};
+  MPI_Comm_rank(cart_comm, &rank);
+  MPI_Cart_coords(cart_comm, rank, 2, coords);
+
+  const auto [local_rows, row_offset] = split_extent(grid_size, dims[0], coords[0]);
+  const auto [local_cols, col_offset] = split_extent(grid_size, dims[1], coords[1]);
+  const Partition p{rank, size, local_rows, row_offset, local_cols, col_offset};
+
+  const auto row_words = local_cols + 2;
+  const auto rows = local_rows + 2;
+
+  // Buffer cell b, k holds global cell row_offset + b - 1, col_offset + k - 1, wrapping around
+  const auto value = [&](usize b, usize k) {
+    return cell_value(row_offset + grid_size + b - 1, col_offset + grid_size + k - 1, grid_size);
+  };
+
+  const auto fill = [&](std::vector<u8> &buf) {
+    buf.assign(rows * row_words, 0);
+    for (usize b = 1; b <= local_rows; b++) {
+      for (usize k = 1; k <= local_cols; k++) {
+        buf[b * row_words + k] = value(b, k);
+      }
+    }
+  };
+
+  const auto check = [&](const std::vector<u8> &buf) {
+    bool ok = true;
+    for (usize b = 0; b < rows; b++) {
+      for (usize k = 0; k < row_words; k++) {
+        ok = ok && buf[b * row_words + k] == value(b, k);
+      }
+    }
+    return ok;
+  };
+
+  std::vector<u8> p2p_buf, neighbor_buf, rma_buf;
+  fill(p2p_buf);
+  fill(neighbor_buf);
+  fill(rma_buf);
+
+  auto block_halo = make_block_halo(cart_comm, p, MPI_UNSIGNED_CHAR);
+
+  MPI_Request reqs[16];
+  const auto num_reqs = init_block_halos(p2p_buf.data(), block_halo, cart_comm, reqs, nullptr);
+  auto neighbor_halo = make_block_neighbor_halo(block_halo, cart_comm);
+
+  const auto p2p_us = time_exchanges(exchanges, cart_comm, [&] {
+    MPI_Startall(num_reqs, reqs);
+    MPI_Waitall(num_reqs, reqs, MPI_STATUSES_IGNORE);
+  });
+
+  const auto neighbor_us = time_exchanges(exchanges, cart_comm, [&] {
+    MPI_Request request = MPI_REQUEST_NULL;
+    start_neighbor_halo(neighbor_buf.data(), neighbor_halo, &request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+  });
+
+  bool rma_ok = true;
+  const auto rma_us = time_rma(
+      rma_buf, exchanges, cart_comm,
+      [&](u8 *const *bufs, usize words) {
+        return make_block_rma_halo(bufs, words, block_halo, p, MPI_UNSIGNED_CHAR, cart_comm);
+      },
+      check, rma_ok);
+
+  const auto ok = all_ok(check(p2p_buf) && check(neighbor_buf) && rma_ok, cart_comm);
+
+  if (rank == 0) {
+    fmt::println("blocks   {:>4} ranks {:>3} x {:<3}  {}", size, dims[0], dims[1],
+                 format_times(p2p_us, neighbor_us, rma_us));
+  }
+
+  for (int i = 0; i < num_reqs; i++) {
+    MPI_Request_free(&reqs[i]);
+  }
+  free_neighbor_halo(neighbor_halo);
+  free_block_halo(block_halo);
+  MPI_Comm_free(&cart_comm);
+
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+
+  int rank = 0, size = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  const usize grid_size = (argc > 1) ? std::stoul(argv[1]) : 4096;
+  const usize exchanges = (argc > 2) ? std::stoul(argv[2]) : 1000;
+  const usize depth = (argc > 3) ? std::stoul(argv[3]) : 1;
+
+  if (depth == 0 || grid_size / static_cast<usize>(size) < depth) {
+    root_println("Error: every rank needs at least halo_depth rows, and halo_depth at least 1");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  root_println("{} x {} grid, {} exchanges", grid_size, grid_size, exchanges);
+
+  const auto rows_ok = bench_rows(grid_size, exchanges, depth, MPI_COMM_WORLD);
+  const auto blocks_ok = bench_blocks(grid_size, exchanges, MPI_COMM_WORLD);
+
+  if (!rows_ok || !blocks_ok) {
+    root_println("Error: a backend filled the halos with the wrong cells");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  MPI_Finalize();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+#include "hashlife.hpp"
+
+#include <algorithm>
+#include <bit>
+
+auto hashlife_join(Hashlife &h, NodeId nw, NodeId ne, NodeId sw, NodeId se) -> NodeId {
+  const QuadKey key{nw, ne, sw, se};
+
+  if (const auto found = h.canonical.find(key); found != h.canonical.end()) {
+    return found->second;
+  }
+
+  HashlifeNode node{nw, ne, sw, se, h.nodes[nw].level + 1,
+                    h.nodes[nw].population + h.nodes[ne].population + h.nodes[sw].population
+                        + h.nodes[se].population};
+
+  const auto id = static_cast<NodeId>(h.nodes.size());
+  h.nodes.push_back(node);
+  h.canonical.emplace(key, id);
+
+  return id;
+}
+
+static auto empty_node(Hashlife &h, u32 level) -> NodeId {
+  while (h.empty.size() <= level) {
+    const auto e = h.empty.back();
+    h.empty.push_back(hashlife_join(h, e, e, e, e));
+  }
+  return h.empty[level];
+}
+
+// Centre half of a node of level >= 2, at the same generation
+static auto centre(Hashlife &h, NodeId id) -> NodeId {
+  const auto n = h.nodes[id];
+  return hashlife_join(h, h.nodes[n.nw].se, h.nodes[n.ne].sw, h.nodes[n.sw].ne, h.nodes[n.se].nw);
+}
+
+// State of cell (r, c) of a node
+static auto cell(const Hashlife &h, NodeId id, usize r, usize c) -> u8 {
+  while (h.nodes[id].level > 0) {
+    const auto &n = h.nodes[id];
+    const auto half = usize{1} << (n.level - 1);
+
+    if (r < half) {
+      id = (c < half) ? n.nw : n.ne;
+    } else {
+      id = (c < half) ? n.sw : n.se;
+    }
+
+    r %= half;
+    c %= half;
+  }
+
+  return static_cast<u8>(id);
+}
+
+// The recursion bottoms out at 4x4 squares, whose 2x2 centre we step one generation directly
+static auto life_4x4(Hashlife &h, NodeId id) -> NodeId {
+  NodeId next[2][2];
+
+  for (usize r = 1; r <= 2; r++) {
+    for (usize c = 1; c <= 2; c++) {
+      int nsum = 0;
+      for (usize i = r - 1; i <= r + 1; i++) {
+        for (usize j = c - 1; j <= c + 1; j++) {
+          nsum += cell(h, id, i, j);
+        }
+      }
+
+      const auto cur = cell(h, id, r, c);
+      nsum -= cur;
+
+      next[r - 1][c - 1] = h.rule.next(static_cast<u8>(nsum), cur);
+    }
+  }
+
+  return hashlife_join(h, next[0][0], next[0][1], next[1][0], next[1][1]);
+}
+
+auto hashlife_step(Hashlife &h, NodeId id, u32 k) -> NodeId {
+  // Copy, as creating nodes below may reallocate the node vector
+  const auto n = h.nodes[id];
+
+  if (n.population == 0) {
+    return empty_node(h, n.level - 1);
+  }
+
+  const auto key = (id << 6) | k;
+  if (const auto found = h.results.find(key); found != h.results.end()) {
+    return found->second;
+  }
+
+  NodeId result = 0;
+
+  if (n.level == 2) {
+    result = life_4x4(h, id);
+  } else {
+    const auto nw = h.nodes[n.nw];
+    const auto ne = h.nodes[n.ne];
+    const auto sw = h.nodes[n.sw];
+    const auto se = h.nodes[n.se];
+
+    // Nine overlapping squares of level L - 1 covering the node, in reading order
+    const NodeId sub[3][3] = {
+        {n.nw, hashlife_join(h, nw.ne, ne.nw, nw.se, ne.sw), n.ne},
+        {hashlife_join(h, nw.sw, nw.se, sw.nw, sw.ne), hashlife_join(h, nw.se, ne.sw, sw.ne, se.nw),
+         hashlife_join(h, ne.sw, ne.se, se.nw, se.ne)},
+        {n.sw, hashlife_join(h, sw.ne, se.nw, sw.se, se.sw), n.se},
+    };
+
+    /*
+     * At full speed (k = L - 2), both halves of the recursion advance 2^(L-3) generations. For a
+     * smaller step, the first half only takes the centres and the second half does all the work.
+     */
+    NodeId mid[3][3];
+    for (usize i = 0; i < 3; i++) {
+      for (usize j = 0; j < 3; j++) {
+        mid[i][j] = (k + 2 == n.level) ? hashlife_step(h, sub[i][j], n.level - 3)
+                                       : centre(h, sub[i][j]);
+      }
+    }
+
+    const auto k2 = std::min(k, n.level - 3);
+
+    result = hashlife_join(
+        h, hashlife_step(h, hashlife_join(h, mid[0][0], mid[0][1], mid[1][0], mid[1][1]), k2),
+        hashlife_step(h, hashlife_join(h, mid[0][1], mid[0][2], mid[1][1], mid[1][2]), k2),
+        hashlife_step(h, hashlife_join(h, mid[1][0], mid[1][1], mid[2][0], mid[2][1]), k2),
+        hashlife_step(h, hashlife_join(h, mid[1][1], mid[1][2], mid[2][1], mid[2][2]), k2));
+  }
+
+  h.results.emplace(key, result);
+
+  return result;
+}
+
+/*
+ * Advance a periodic grid of level n by 2^k generations. We tile the grid up to level
+ * L = max(n + 1, k + 2) and step that. The result is the square of side 2^(L-1) starting at
+ * 2^(L-2) in both directions. For L = n + 1 that is the grid shifted by half its size, which we
+ * undo by swapping diagonal quadrants. For larger L the shift is a whole number of grids and any
+ * grid-sized corner of the result is the grid.
+ */
+static auto advance_pow2(Hashlife &h, NodeId root, u32 k) -> NodeId {
+  const auto level = h.nodes[root].level;
+  const auto target = std::max(level + 1, k + 2);
+
+  auto tile = root;
+  while (h.nodes[tile].level < target) {
+    tile = hashlife_join(h, tile, tile, tile, tile);
+  }
+
+  auto result = hashlife_step(h, tile, k);
+
+  if (target == level + 1) {
+    const auto r = h.nodes[result];
+    return hashlife_join(h, r.se, r.sw, r.ne, r.nw);
+  }
+
+  while (h.nodes[result].level > level) {
+    result = h.nodes[result].nw;
+  }
+
+  return result;
+}
+
+auto hashlife_advance(Hashlife &h, NodeId root, u64 generations) -> NodeId {
+  while (generations != 0) {
+    const auto k = static_cast<u32>(std::countr_zero(generations));
+    root = advance_pow2(h, root, k);
+    generations &= generations - 1;
+  }
+
+  return root;
+}
+
+static auto build(Hashlife &h, const std::vector<u8> &bits, usize row_bytes, u32 level, usize r,
+                  usize c) -> NodeId {
+  if (level == 0) {
+    return static_cast<NodeId>((bits[r * row_bytes + c / 8] >> (c % 8)) & 1);
+  }
+
+  const auto half = usize{1} << (level - 1);
+  return hashlife_join(h, build(h, bits, row_bytes, level - 1, r, c),
+                       build(h, bits, row_bytes, level - 1, r, c + half),
+                       build(h, bits, row_bytes, level - 1, r + half, c),
+                       build(h, bits, row_bytes, level - 1, r + half, c + half));
+}
+
+auto hashlife_from_bits(Hashlife &h, const std::vector<u8> &bits, usize grid_size) -> NodeId {
+  const auto level = static_cast<u32>(std::countr_zero(grid_size));
+  return build(h, bits, (grid_size + 7) / 8, level, 0, 0);
+}
+
+// Set the bits of the live cells of a node, skipping empty quadrants
+static void flatten(const Hashlife &h, NodeId id, usize row_bytes, usize r, usize c,
+                    std::vector<u8> &bits) {
+  const auto &n = h.nodes[id];
+
+  if (n.population == 0) {
+    return;
+  }
+
+  if (n.level == 0) {
+    bits[r * row_bytes + c / 8] = static_cast<u8>(bits[r * row_bytes + c / 8] | (1 << (c % 8)));
+    return;
+  }
+
+  const auto half = usize{1} << (n.level - 1);
+  flatten(h, n.nw, row_bytes, r, c, bits);
+  flatten(h, n.ne, row_bytes, r, c + half, bits);
+  flatten(h, n.sw, row_bytes, r + half, c, bits);
+  flatten(h, n.se, row_bytes, r + half, c + half, bits);
+}
+
+void hashlife_to_bits(const Hashlife &h, NodeId root, usize grid_size, std::vector<u8> &bits) {
+  const auto row_bytes = (grid_size + 7) / 8;
+  bits.assign(grid_size * row_bytes, 0);
+  flatten(h, root, row_bytes, 0, 0, bits);
+}
@@ -0,0 +1,92 @@
+#ifndef MPI_GOL_HASHLIFE_HPP
+#define MPI_GOL_HASHLIFE_HPP
+
+/*
+ * Hashlife, Bill Gosper's algorithm for running the game of life very far into the future.
+ *
+ * The grid is stored as a quadtree. A node of level L is a 2^L x 2^L square made of four nodes of
+ * level L - 1, and the nodes of level 0 are single cells. Nodes are canonical: there is exactly one
+ * node for each distinct square, found through a hash table. A grid with lots of repetition, like
+ * empty space or a few gliders, thus takes very few nodes.
+ *
+ * The trick is the result of a node: the centre half of its square, 2^(L-2) generations later.
+ * This only depends on the node itself, so we compute it once per node and remember it. It is
+ * computed recursively from the results of smaller nodes, and because the same nodes keep showing
+ * up, a whole structured grid can be advanced 2^k generations at once with a handful of lookups.
+ *
+ * Hashlife works on an infinite plane, while our grid is periodic. A periodic grid is the same as
+ * the infinite plane tiled with copies of it, so we build a node made of copies of the grid, large
+ * enough that the result covers the grid once, and read the grid back from that result.
+ */
+
+#include "cells.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Nodes are never freed, so a long run on a chaotic grid keeps creating new ones. With 64 bit ids
+ * the memory runs out long before the ids do, where 32 bit ids would silently wrap around.
+ */
+using NodeId = u64;
+
+struct HashlifeNode {
+  NodeId nw{0}, ne{0}, sw{0}, se{0}; // Quadrants. Unused for single cells
+  u32 level{0};                      // The node is a 2^level x 2^level square
+  u64 population{0};                 // Live cells in the node
+};
+
+// Hash table key of a node: its four quadrants
+struct QuadKey {
+  NodeId nw, ne, sw, se;
+
+  auto operator==(const QuadKey &) const -> bool = default;
+};
+
+struct QuadKeyHash {
+  auto operator()(const QuadKey &key) const -> usize {
+    auto h = key.nw;
+    h = h * 0x9e3779b97f4a7c15 + key.ne;
+    h = h * 0x9e3779b97f4a7c15 + key.sw;
+    h = h * 0x9e3779b97f4a7c15 + key.se;
+    return static_cast<usize>(h ^ (h >> 29));
+  }
+};
+
+struct Hashlife {
+  // All nodes ever created. Node 0 is a dead cell and node 1 a live one
+  std::vector<HashlifeNode> nodes{HashlifeNode{}, HashlifeNode{0, 0, 0, 0, 0, 1}};
+
+  // Canonical node for each combination of quadrants
+  std::unordered_map<QuadKey, NodeId, QuadKeyHash> canonical;
+
+  // Memoized results, keyed by node shifted left by 6 bits and by log2 of the generations advanced
+  std::unordered_map<u64, NodeId> results;
+
+  // Empty node of each level
+  std::vector<NodeId> empty{0};
+
+  // Rule the nodes are advanced with. Memoized results are only valid for this rule
+  MaskRule rule{ConwayRule::masks};
+};
+
+// The canonical node with the given quadrants, which must all have the same level
+auto hashlife_join(Hashlife &h, NodeId nw, NodeId ne, NodeId sw, NodeId se) -> NodeId;
+
+// Centre half of a node of level L >= 2, 2^k generations later, with k <= L - 2
+auto hashlife_step(Hashlife &h, NodeId id, u32 k) -> NodeId;
+
+/*
+ * Advance a periodic grid, given as a node of level >= 2, by `generations` generations. Each set
+ * bit of `generations` costs one call to hashlife_step().
+ */
+auto hashlife_advance(Hashlife &h, NodeId root, u64 generations) -> NodeId;
+
+/*
+ * Convert between a node and a grid_size x grid_size grid packed one bit per cell like the
+ * snapshots. grid_size must be a power of two.
+ */
+auto hashlife_from_bits(Hashlife &h, const std::vector<u8> &bits, usize grid_size) -> NodeId;
+void hashlife_to_bits(const Hashlife &h, NodeId root, usize grid_size, std::vector<u8> &bits);
+
+#endif // MPI_GOL_HASHLIFE_HPP
@@ -0,0 +1,148 @@
+/*
+ * Benchmark of the row update kernels of cells.hpp, on a single core and without MPI.
+ *
+ * Usage: gol_kernel_bench [grid_size] [generations]
+ *
+ * Every kernel advances the same random periodic grid of B3/S23 for the same number of generations,
+ * and we report the time per cell update. The kernels are:
+ *
+ *  - naive:  ByteCells::update_cell() for every cell, summing the neighbours one by one
+ *  - bytes:  ByteCells rows, through the vectorized kernel of byte_kernel.cpp
+ *  - packed: PackedCells rows, 64 cells per word with bitwise full adders
+ *  - table:  TableCells rows, two at a time through the 4 x 4 -> 2 x 2 lookup table
+ *
+ * All of them must end up with the same grid, which we check through the number of live cells.
+ */
+
+#include "cells.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Run `generations` generations of `cells`, a grid_size x grid_size grid with one byte per cell,
+ * stored with policy Cells. `kernel(cur, next, row_words)` computes every data row of `next` from
+ * `cur`. Rows 0 and grid_size + 1 are halo rows, which we fill with the opposite data rows.
+ * Returns the number of live cells at the end.
+ */
+template <typename Cells, typename Kernel>
+static auto bench(const char *name, const std::vector<u8> &cells, usize grid_size,
+                  usize generations, Kernel kernel) -> long {
+  using word = typename Cells::word;
+
+  const auto row_words = Cells::row_words(grid_size);
+  std::vector<word> cur((grid_size + 2) * row_words, 0);
+  std::vector<word> next((grid_size + 2) * row_words, 0);
+
+  for (usize r = 0; r < grid_size; r++) {
+    for (usize c = 0; c < grid_size; c++) {
+      Cells::set(cur.data() + (r + 1) * row_words, c, cells[r * grid_size + c]);
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (usize g = 0; g < generations; g++) {
+    std::copy_n(cur.data() + grid_size * row_words, row_words, cur.data());
+    std::copy_n(cur.data() + row_words, row_words, cur.data() + (grid_size + 1) * row_words);
+
+    kernel(cur.data(), next.data(), row_words);
+    std::swap(cur, next);
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+
+  long live = 0;
+  for (usize r = 1; r <= grid_size; r++) {
+    live += Cells::count_live(cur.data() + r * row_words, grid_size);
+  }
+
+  const auto seconds = std::chrono::duration<double>(end - start).count();
+  const auto updates = static_cast<double>(grid_size * grid_size * generations);
+
+  fmt::println("{:<8} {:>9.3f} ns per cell {:>9.3f} Gcells/s {:>10} live cells", name,
+               1.0e9 * seconds / updates, updates / seconds / 1.0e9, live);
+
+  return live;
+}
+
+int main(int argc, char **argv) {
+  const usize grid_size = (argc > 1) ? std::stoul(argv[1]) : 2048;
+  const usize generations = (argc > 2) ? std::stoul(argv[2]) : 100;
+
+  std::mt19937_64 rng(64);
+  std::uniform_int_distribution<int> bit(0, 1);
+
+  std::vector<u8> cells(grid_size * grid_size);
+  for (auto &cell : cells) {
+    cell = static_cast<u8>(bit(rng));
+  }
+
+  const ConwayRule rule;
+  const auto n = grid_size;
+
+  fmt::println("{} x {} grid, {} generations", grid_size, grid_size, generations);
+
+  const auto naive = [&](const u8 *cur, u8 *next, usize row_words) {
+    for (usize r = 1; r <= n; r++) {
+      const auto *up = cur + (r - 1) * row_words;
+      const auto *mid = cur + r * row_words;
+      const auto *dn = cur + (r + 1) * row_words;
+
+      for (usize c = 0; c < n; c++) {
+        next[r * row_words + c] = ByteCells::update_cell(rule, up, mid, dn, c, n);
+      }
+    }
+  };
+
+  const auto bytes = [&](const u8 *cur, u8 *next, usize row_words) {
+    for (usize r = 1; r <= n; r++) {
+      ByteCells::update_row(rule, cur + (r - 1) * row_words, cur + r * row_words,
+                            cur + (r + 1) * row_words, next + r * row_words, n);
+    }
+  };
+
+  const auto packed = [&](const u64 *cur, u64 *next, usize row_words) {
+    for (usize r = 1; r <= n; r++) {
+      PackedCells::update_row(rule, cur + (r - 1) * row_words, cur + r * row_words,
+                              cur + (r + 1) * row_words, next + r * row_words, n);
+    }
+  };
+
+  // Rows in pairs, and the last row on its own if there is an odd number of them
+  const auto table = [&](const u64 *cur, u64 *next, usize row_words) {
+    usize r = 1;
+    for (; r + 1 <= n; r += 2) {
+      TableCells::update_pair(rule, cur + (r - 1) * row_words, cur + r * row_words,
+                              cur + (r + 1) * row_words, cur + (r + 2) * row_words,
+                              next + r * row_words, next + (r + 1) * row_words, n, 0, n);
+    }
+
+    if (r == n) {
+      TableCells::update_row(rule, cur + (r - 1) * row_words, cur + r * row_words,
+                             cur + (r + 1) * row_words, next + r * row_words, n);
+    }
+  };
+
+  const long live[4] = {
+      bench<ByteCells>("naive", cells, n, generations, naive),
+      bench<ByteCells>("bytes", cells, n, generations, bytes),
+      bench<PackedCells>("packed", cells, n, generations, packed),
+      bench<TableCells>("table", cells, n, generations, table),
+  };
+
+  for (const auto l : live) {
+    if (l != live[0]) {
+      fmt::println("Error: the kernels do not agree on the final grid");
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
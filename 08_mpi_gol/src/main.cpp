@@ -2,76 +2,354 @@
  * This is Conway's game of life parallelized using MPI
  */
 
+#include "async_snapshot.hpp"
+#include "balance.hpp"
+#include "cells.hpp"
+#include "checkpoint.hpp"
+#include "delta_stream.hpp"
+#include "density.hpp"
+#include "gol.hpp"
+#include "halo.hpp"
+#include "hashlife.hpp"
+#include "pattern.hpp"
+#include "philox.hpp"
+#include "snapshot.hpp"
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <deque>
 #include <experimental/mdspan>
 #include <fmt/format.h>
+#include <memory>
 #include <mpi.h>
-#include <random>
+#include <numeric>
+#include <omp.h>
+#include <thread>
 #include <toml++/toml.hpp>
+#include <utility>
 #include <vector>
 
 namespace stde = std::experimental;
 
-using usize = std::size_t;
-using u8 = std::uint8_t;
+Partition compute_partition(const SimulationData &sd, int rank, int size) {
+  const auto [local, offset] = split_extent(sd.grid_size, size, rank);
+  return Partition{rank, size, local, offset, sd.grid_size, 0};
+}
+
+/*
+ * Compute 2D block partitioning. The ranks of `cart_comm` are laid out in a periodic
+ * dims[0] x dims[1] process grid, and each one owns the rows of its process row and the columns of
+ * its process column.
+ *
+ * Columns are handed out in groups of 8, so that every rank owns whole bytes of a bit packed row
+ * when we write snapshots. Only the last process column may get a partial group.
+ */
+Partition compute_block_partition(const SimulationData &sd, MPI_Comm cart_comm) {
+  int rank = 0, size = 0;
+  MPI_Comm_rank(cart_comm, &rank);
+  MPI_Comm_size(cart_comm, &size);
+
+  int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2] = {0, 0};
+  MPI_Cart_get(cart_comm, 2, dims, periods, coords);
+
+  const auto [local_rows, row_offset] = split_extent(sd.grid_size, dims[0], coords[0]);
+  const auto [col_bytes, byte_offset]
+      = split_extent(packed_row_bytes(sd.grid_size), dims[1], coords[1]);
+  const auto col_offset = 8 * byte_offset;
+  const auto local_cols = std::min(8 * col_bytes, sd.grid_size - col_offset);
+
+  return Partition{rank, size, local_rows, row_offset, local_cols, col_offset};
+}
+
+
+/*
+ * Allocator that default-initializes elements instead of value-initializing them, so a new
+ * std::vector<u8> is not zeroed (and its pages are not touched) by the thread that creates it.
+ */
+template <typename T> struct FirstTouchAllocator : std::allocator<T> {
+  template <typename U> struct rebind {
+    using other = FirstTouchAllocator<U>;
+  };
+
+  template <typename U> void construct(U *ptr) noexcept { ::new (static_cast<void *>(ptr)) U; }
 
-// Store simulation data
-enum IDType : int { glider_id, random_id };
+  template <typename U, typename... Args> void construct(U *ptr, Args &&...args) {
+    ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+  }
+};
+
+/*
+ * A local buffer of rows. It owns its memory, unless the shared halo exchange placed it in a shared
+ * memory window (see SharedHalo), and then it only points there.
+ */
+template <typename word> struct GridBuffer {
+  std::vector<word, FirstTouchAllocator<word>> owned;
+  word *rows{nullptr};
+  usize words{0};
 
-struct SimulationData {
-  usize grid_size{32};       // Gobal grid size. The grid is always square.
-  usize generations{32};     // Numbner of generations
-  usize stats_every{1};      // Output statistics every STATS_EVERY iterations
-  usize data_every{1};       // Dump data to disk every DATA_EVERY iterations
-  usize random_seed{64};     // Random seed used in initialization
-  IDType id_type{random_id}; // Type of initial data
+  auto data() const -> word * { return rows; }
+  auto size() const -> usize { return words; }
 };
 
-// Compute local stripe partitioning (rows per rank)
-struct Partition {
-  int rank{0};         // Rank that owns the partition
-  int size{0};         // Total number of ranks
-  usize local_rows{0}; // Number of data rows (excluding halo rows)
-  usize row_offset{0}; // Global index of the first row owned by this rank.
+/*
+ * Allocate a local buffer of `rows` rows, or place it at `memory` if that is not null. The
+ * operating system backs a page of memory with physical memory on the NUMA domain of the thread
+ * that writes to it first. The buffer is left uninitialized by the allocator, and we clear it here
+ * with the same static schedule that the generation loop uses, so each thread's rows end up in
+ * memory close to the core it runs on.
+ */
+template <typename word>
+static void allocate_rows(GridBuffer<word> &buf, usize rows, usize row_words,
+                          word *memory = nullptr) {
+  if (memory == nullptr) {
+    buf.owned = std::vector<word, FirstTouchAllocator<word>>(rows * row_words);
+    memory = buf.owned.data();
+  } else {
+    buf.owned = {};
+  }
+
+  buf.rows = memory;
+  buf.words = rows * row_words;
+
+#pragma omp parallel for default(none) schedule(static) shared(buf, rows, row_words)
+  for (usize r = 0; r < rows; r++) {
+    std::fill_n(buf.data() + r * row_words, row_words, word{0});
+  }
+}
+
+/*
+ * Time (ns) each rank spends in the phases of a generation. Everything that is not in a phase of
+ * its own, like swapping the buffers, is `other`. Only the main thread times, with the steady
+ * clock, at a handful of points per generation, so this costs next to nothing.
+ */
+enum Phase : int {
+  compute_phase, // Updating cells, including posting the halo exchange
+  halo_phase,    // Waiting for halos with nothing left to compute
+  stats_phase,   // Adding up the counts of cells and posting their reduction
+  output_phase,  // Snapshots, density maps, the delta stream and checkpoints
+  balance_phase, // Load balancing
+  num_phases
 };
 
-Partition compute_partition(const SimulationData &sd, int rank, int size) {
+struct PhaseTimers {
+  long ns[num_phases]{};
+  long total{0};       // Wall time of the generations
+  long cells{0};       // Cell updates, data cells only
+  long generations{0}; // Generations timed
+
   /*
-   * To allow for grid_size be divisible by size, we will use the same trick we used in the first
-   * OpenMP parallelization example and distribuite the cell remainder across ranks allow
-   * sd.grid_size not
+   * How well the halo exchange overlaps with computing. The compute phase splits into the interior
+   * rows, which need no halo data, and the boundary cells, which are the rest of it.
    */
-  const auto base = sd.grid_size / static_cast<usize>(size);
-  const auto rem = sd.grid_size % static_cast<usize>(size);
+  long halo_flight{0}; // From posting the halo exchange until all of it has arrived
+  long interior{0};    // Updating the rows that need no halo data, posting the halos included
+  long exchanges{0};   // Halo exchanges done
+  long rows{0};        // Rows updated, including the deep halo rows
+
+  auto operator+=(const PhaseTimers &other) -> PhaseTimers & {
+    for (int i = 0; i < num_phases; i++) {
+      ns[i] += other.ns[i];
+    }
+    total += other.total;
+    cells += other.cells;
+    generations += other.generations;
+    halo_flight += other.halo_flight;
+    interior += other.interior;
+    exchanges += other.exchanges;
+    rows += other.rows;
+    return *this;
+  }
+};
 
-  const auto local = base + (static_cast<usize>(rank) < rem ? 1 : 0);
-  const auto offset = base * static_cast<usize>(rank) + std::min(static_cast<usize>(rank), rem);
+/*
+ * Print the min, mean and max over ranks of the time of each phase from generation `first` on. The
+ * rate of cell updates of each rank is over its wall time, and the load imbalance is the slowest
+ * compute time over the mean one: 1 is a perfect balance, and with 1.25 the slowest rank holds up
+ * all others by a quarter of the mean.
+ *
+ * Then comes the overlap of the halo exchange, averaged over ranks. The part of the exchange that
+ * was hidden is the time the halos were in flight minus the time we still had to wait for them.
+ *
+ * We also estimate the best halo depth. An exchange costs us its exposed time t_x and a row costs
+ * t_row to update. With depth k we pay t_x once every k generations, and on average k - 1 extra
+ * rows per generation, so a generation costs t_x / k + (local_rows + k - 1) t_row. This is lowest
+ * for k = sqrt(t_x / t_row).
+ */
+static void report_phases(const PhaseTimers &timers, usize first, const SimulationData &sd,
+                          const Partition &p, MPI_Comm comm) {
+  const auto rank = p.rank;
+  const auto size = p.size;
 
-  return Partition{rank, size, local, offset};
-}
+  constexpr int values = num_phases + 3;
+  constexpr const char *names[values]
+      = {"compute", "halo", "stats", "output", "balance", "other", "total", "cells/s"};
+
+  double local[values];
+  long timed = 0;
+  for (int i = 0; i < num_phases; i++) {
+    local[i] = static_cast<double>(timers.ns[i]) / 1.0e9;
+    timed += timers.ns[i];
+  }
+  const auto seconds = static_cast<double>(timers.total) / 1.0e9;
+  local[num_phases] = static_cast<double>(timers.total - timed) / 1.0e9;
+  local[num_phases + 1] = seconds;
+  local[num_phases + 2] = (seconds > 0.0) ? static_cast<double>(timers.cells) / seconds : 0.0;
+
+  double min[values], max[values], sum[values];
+  MPI_Reduce(local, min, values, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(local, max, values, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(local, sum, values, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+  const long overlap[4] = {timers.halo_flight, timers.interior, timers.exchanges, timers.rows};
+  long overlap_sum[4] = {0, 0, 0, 0};
+  MPI_Reduce(overlap, overlap_sum, 4, MPI_LONG, MPI_SUM, 0, comm);
+
+  const auto local_rows = static_cast<long>(p.local_rows);
+  long min_rows = 0;
+  MPI_Reduce(&local_rows, &min_rows, 1, MPI_LONG, MPI_MIN, 0, comm);
+
+  if (rank != 0) {
+    return;
+  }
+
+  fmt::println("Phase timers, generations {} to {} (min / mean / max over {} ranks):", first,
+               first + static_cast<usize>(timers.generations) - 1, size);
 
-// Print only on rank zero
-#define root_println(format, ...)                                                                  \
-  if (rank == 0) {                                                                                 \
-    fmt::println(format __VA_OPT__(, ) __VA_ARGS__);                                               \
+  for (int i = 0; i < values; i++) {
+    const auto unit = (i < values - 1) ? " s" : "";
+    fmt::println("  {:<8} {:.3e}{} / {:.3e}{} / {:.3e}{}", names[i], min[i], unit, sum[i] / size,
+                 unit, max[i], unit);
   }
 
-// Get a pointer to the start of a row. MPI needs this
-static inline auto row_ptr(const SimulationData &sd, u8 *data_ptr, usize r) -> u8 * {
-  return data_ptr + (r * sd.grid_size);
+  const auto mean_compute = sum[compute_phase] / size;
+  fmt::println("  Load imbalance: {:.3f} (slowest compute time over the mean)",
+               (mean_compute > 0.0) ? max[compute_phase] / mean_compute : 1.0);
+
+  const auto flight = static_cast<double>(overlap_sum[0]) / size / 1.0e9;
+  const auto exposed = sum[halo_phase] / size;
+  const auto hidden = flight - exposed;
+  const auto interior = static_cast<double>(overlap_sum[1]) / size / 1.0e9;
+
+  fmt::println("Halo exchange: {:.6e} s in flight, {:.6e} s hidden, {:.6e} s exposed ({:.1f}% "
+               "hidden)",
+               flight, hidden, exposed, flight > 0.0 ? 100.0 * hidden / flight : 0.0);
+  fmt::println("Compute: {:.6e} s interior rows, {:.6e} s boundary cells", interior,
+               mean_compute - interior);
+
+  const auto exchanges = overlap_sum[2];
+  const auto rows = overlap_sum[3];
+  if (exchanges == 0 || rows == 0) {
+    return;
+  }
+
+  const auto per_exchange = sum[halo_phase] / static_cast<double>(exchanges);
+  const auto per_row = sum[compute_phase] / static_cast<double>(rows);
+  const auto best = std::clamp(std::lround(std::sqrt(per_exchange / per_row)), 1L,
+                               std::max(min_rows, 1L));
+
+  fmt::println("Halo depth {}: {:.3e} s exposed per exchange, {:.3e} s per row, best depth for {} "
+               "ranks on a {} grid is about {}",
+               sd.halo_depth, per_exchange, per_row, size, sd.grid_size, best);
+}
+
+// Work done and avoided in sparse mode
+struct SparseStats {
+  long tiles{0};         // Tiles we could have updated
+  long tiles_updated{0}; // Tiles we did update
+  long sends{0};         // Halo sends
+  long sends_skipped{0}; // Halo sends that went out as empty messages
+};
+
+static void report_sparse(const SparseStats &stats, int rank, MPI_Comm comm) {
+  long local[4] = {stats.tiles, stats.tiles_updated, stats.sends, stats.sends_skipped};
+  long total[4] = {0, 0, 0, 0};
+  MPI_Reduce(local, total, 4, MPI_LONG, MPI_SUM, 0, comm);
+
+  const auto percent = [](long part, long whole) {
+    return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+  };
+
+  root_println("Sparse tiles: {:.1f}% of tiles updated, {:.1f}% of halo sends skipped",
+               percent(total[1], total[0]), percent(total[3], total[2]));
+}
+
+/*
+ * A reduction of the counts of a generation we report. We never wait for it right away: it
+ * completes while we compute the next generations, and a later step prints it once MPI_Test finds
+ * it done. Non-blocking collectives complete in the order they were started, so the lines still
+ * come out in order of generations. The request points into local and total, so pending stats
+ * live in a std::deque, which does not move its elements when we add or remove them at the ends.
+ */
+struct PendingStats {
+  usize step{0};
+  bool first{false}; // No generation before it to count births and deaths against
+  long local[3]{0, 0, 0};
+  long total[3]{0, 0, 0};
+  MPI_Request request{MPI_REQUEST_NULL};
 };
 
+static void post_stats(std::deque<PendingStats> &pending, usize step, const CellCounts &counts,
+                       bool first, MPI_Comm comm) {
+  auto &stats = pending.emplace_back();
+  stats.step = step;
+  stats.first = first;
+  stats.local[0] = counts.live;
+  stats.local[1] = counts.births;
+  stats.local[2] = counts.deaths;
+
+  MPI_Ireduce(stats.local, stats.total, 3, MPI_LONG, MPI_SUM, 0, comm, &stats.request);
+}
+
+// Print the reductions that are done, oldest first. With `wait`, wait for all of them.
+static void drain_stats(std::deque<PendingStats> &pending, bool wait, int rank) {
+  while (!pending.empty()) {
+    auto &stats = pending.front();
+
+    int done = 1;
+    if (wait) {
+      MPI_Wait(&stats.request, MPI_STATUS_IGNORE);
+    } else {
+      MPI_Test(&stats.request, &done, MPI_STATUS_IGNORE);
+    }
+
+    if (done == 0) {
+      return;
+    }
+
+    if (stats.first) {
+      root_println("Iteration {}. Live cells {}", stats.step, stats.total[0]);
+    } else {
+      root_println("Iteration {}. Live cells {}, births {}, deaths {}", stats.step, stats.total[0],
+                   stats.total[1], stats.total[2]);
+    }
+
+    pending.pop_front();
+  }
+}
+
+static inline auto elapsed_ns(std::chrono::steady_clock::time_point start,
+                              std::chrono::steady_clock::time_point end) -> long {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
 auto parse_sim_data(const char *file_path) -> SimulationData {
   SimulationData data;
 
   const auto toml_file = toml::parse_file(file_path);
 
-  data.grid_size = static_cast<usize>(toml_file["general"]["grid_size"].value_or(32));
-  data.generations = static_cast<usize>(toml_file["general"]["generations"].value_or(32));
-  data.stats_every = static_cast<usize>(toml_file["general"]["stats_every"].value_or(1));
-  data.data_every = static_cast<usize>(toml_file["general"]["data_every"].value_or(1));
+  // 64 bit reads, since Hashlife runs can go for far more than 2^31 generations
+  data.grid_size = static_cast<usize>(toml_file["general"]["grid_size"].value_or(i64{32}));
+  data.generations = static_cast<usize>(toml_file["general"]["generations"].value_or(i64{32}));
+  data.stats_every = static_cast<usize>(toml_file["general"]["stats_every"].value_or(i64{1}));
+  data.timers_every = static_cast<usize>(toml_file["general"]["timers_every"].value_or(i64{0}));
+  data.data_every = static_cast<usize>(toml_file["general"]["data_every"].value_or(i64{1}));
   data.random_seed = static_cast<usize>(toml_file["id"]["random_seed"].value_or(64));
 
   const auto id_type = toml_file["id"]["id_type"].value_or("random");
@@ -80,222 +358,1683 @@ auto parse_sim_data(const char *file_path) -> SimulationData {
     data.id_type = IDType::random_id;
   } else if (strcmp(id_type, "glider") == 0) {
     data.id_type = IDType::glider_id;
+  } else if (strcmp(id_type, "file") == 0) {
+    data.id_type = IDType::file_id;
   }
 
-  return data;
-}
+  data.pattern_path = toml_file["id"]["pattern"].value_or("");
+  data.pattern_row = static_cast<usize>(toml_file["id"]["pattern_row"].value_or(i64{0}));
+  data.pattern_col = static_cast<usize>(toml_file["id"]["pattern_col"].value_or(i64{0}));
 
-int main(int argc, char **argv) {
-  using std::swap;
+  const auto storage = toml_file["general"]["storage"].value_or("bytes");
 
-  MPI_Init(&argc, &argv);
+  if (strcmp(storage, "bytes") == 0) {
+    data.storage = StorageType::byte_storage;
+  } else if (strcmp(storage, "packed") == 0) {
+    data.storage = StorageType::packed_storage;
+  } else if (strcmp(storage, "table") == 0) {
+    data.storage = StorageType::table_storage;
+  }
 
-  int rank = 0, size = 0;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  data.sparse = toml_file["sparse"]["enabled"].value_or(false);
+  data.tile_rows = static_cast<usize>(toml_file["sparse"]["tile_rows"].value_or(i64{16}));
+  data.tile_cols = static_cast<usize>(toml_file["sparse"]["tile_cols"].value_or(i64{256}));
 
-  if (argc != 2) {
-    root_println("Usage: {} <config-file.toml>", argv[0]);
-    return EXIT_FAILURE;
+  data.rule_text = toml_file["general"]["rule"].value_or("B3/S23");
+
+  const auto engine = toml_file["general"]["engine"].value_or("sweep");
+
+  if (strcmp(engine, "sweep") == 0) {
+    data.engine = EngineType::sweep_engine;
+  } else if (strcmp(engine, "hashlife") == 0) {
+    data.engine = EngineType::hashlife_engine;
   }
 
-  const auto sd = parse_sim_data(argv[1]);
+  const auto decomposition = toml_file["parallel"]["decomposition"].value_or("rows");
 
-  if (static_cast<usize>(size) > sd.grid_size) {
-    root_println("Warning: more MPI ranks ({}) than rows in grid ({}). Behavior will still be "
-                 "periodic but some ranks will get zero rows.",
-                 size, sd.grid_size);
+  if (strcmp(decomposition, "rows") == 0) {
+    data.decomposition = DecompositionType::row_decomposition;
+  } else if (strcmp(decomposition, "blocks") == 0) {
+    data.decomposition = DecompositionType::block_decomposition;
   }
 
-  const auto p = compute_partition(sd, rank, size);
+  data.threads_per_rank = toml_file["parallel"]["threads_per_rank"].value_or(0);
+  data.ranks_per_node = toml_file["parallel"]["ranks_per_node"].value_or(0);
+  data.halo_depth = static_cast<usize>(toml_file["parallel"]["halo_depth"].value_or(i64{1}));
 
-  /*
-   * This rank has no data rows but we still must participate in communications. For simplicity,
-   * we will terminate these ranks and continue on with the ones that do have some data to work on.
-   */
-  if (p.local_rows == 0) {
-    fmt::println(
-        "Rank {} got 0 rows due to grid size ({}) < num. procs ({}). Exiting those ranks.\n", rank,
-        sd.grid_size, size);
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Finalize();
-    return EXIT_SUCCESS;
+  const auto halo_exchange = toml_file["parallel"]["halo_exchange"].value_or("p2p");
+
+  if (strcmp(halo_exchange, "p2p") == 0) {
+    data.halo_exchange = HaloExchangeType::p2p_exchange;
+  } else if (strcmp(halo_exchange, "neighbor") == 0) {
+    data.halo_exchange = HaloExchangeType::neighbor_exchange;
+  } else if (strcmp(halo_exchange, "rma") == 0) {
+    data.halo_exchange = HaloExchangeType::rma_exchange;
+  } else if (strcmp(halo_exchange, "shared") == 0) {
+    data.halo_exchange = HaloExchangeType::shared_exchange;
   }
 
+  data.balance_every = static_cast<usize>(toml_file["balance"]["every"].value_or(i64{0}));
+  data.balance_tolerance = toml_file["balance"]["tolerance"].value_or(0.05);
+
+  data.async_output = toml_file["output"]["async"].value_or(true);
+  data.queue_depth = static_cast<usize>(toml_file["output"]["queue_depth"].value_or(2));
+  data.density_block = static_cast<usize>(toml_file["output"]["density_block"].value_or(i64{0}));
+  data.keyframe_every = static_cast<usize>(toml_file["output"]["keyframe_every"].value_or(i64{0}));
+
+  data.checkpoint_every = static_cast<usize>(toml_file["checkpoint"]["every"].value_or(i64{0}));
+  data.checkpoint_path = toml_file["checkpoint"]["path"].value_or("gol_checkpoint.bin");
+  data.restart_from = toml_file["checkpoint"]["restart_from"].value_or("");
+
+  data.scaling_repeats = static_cast<usize>(toml_file["scaling"]["repeats"].value_or(i64{5}));
+
+  return data;
+}
+
+/*
+ * Run the simulation on this rank's partition. Cells is one of the storage policies in cells.hpp
+ * and decides how a row of the grid is laid out, exchanged and updated. Rule is one of the rule
+ * policies in rules.hpp.
+ */
+template <typename Cells, typename Rule>
+static auto run(const SimulationData &sd, const Rule &rule, const Partition &initial,
+                MPI_Comm comm) -> int {
+  using std::swap;
+  using word = typename Cells::word;
+
+  // Our rows can change when the load balancer moves them, see balance.hpp
+  auto p = initial;
+
+  const int rank = p.rank;
+  const int size = p.size;
+
   /*
    * Buffers: we allocate (local_rows + 2) rows to hold top and bottom halos.
    * Layout:
    *  row 0 => top halo (from neighbor above)
    *  rows 1..local_rows => actual data, row
    *  local_rows + 1 => bottom halo
+   *
+   * With the 2D block decomposition, every row also has a halo column on each side:
+   *  col 0 => left halo (from neighbor to the left)
+   *  cols 1..local_cols => actual data
+   *  col local_cols + 1 => right halo
+   *
+   * Each row takes Cells::row_words(cols) words. For byte storage this is one word per cell, for
+   * packed storage it is one word per 64 cells.
+   */
+  const bool blocks = (sd.decomposition == block_decomposition);
+  const usize halo_cols = blocks ? 1 : 0;
+
+  /*
+   * With deep halos (see the generation loop) there are halo_depth halo rows on each side. The
+   * deep rows come first in the buffer, so that row 0 is still the halo row next to our data and
+   * rows 1..local_rows are our data rows once we skip them.
+   */
+  const usize deep = sd.halo_depth - 1;
+  const auto row_words = Cells::row_words(p.local_cols + 2 * halo_cols);
+  GridBuffer<word> grid_buf;
+  GridBuffer<word> next_buf;
+
+  /*
+   * With the shared halo exchange the buffers live in a shared memory window of our node, so that
+   * neighbours on the node can read our rows in place, see SharedHalo.
    */
-  const auto rows_with_halo = p.local_rows + 2;
-  std::vector<u8> grid_buf(rows_with_halo * sd.grid_size);
-  std::vector<u8> next_buf(rows_with_halo * sd.grid_size);
+  const bool shared = (sd.halo_exchange == shared_exchange);
+  SharedHalo<word> shared_halo;
+
+  const auto allocate_buffers = [&] {
+    const auto rows = p.local_rows + 2 + 2 * deep;
+
+    if (shared) {
+      shared_halo = make_shared_halo<word>(rows * row_words, comm);
+      allocate_rows(grid_buf, rows, row_words, shared_halo.bufs[0]);
+      allocate_rows(next_buf, rows, row_words, shared_halo.bufs[1]);
+    } else {
+      allocate_rows(grid_buf, rows, row_words);
+      allocate_rows(next_buf, rows, row_words);
+    }
+  };
+
+  allocate_buffers();
 
   /*
    * An mdspan is a multi dimensional view of a contiguous block of data. Being a view, it does not
    * own the data, it only allows us to interact with it on a different way. This is similar to
    * reshaping numpy arrays, if you used those before
    */
-  stde::mdspan grid(grid_buf.data(), rows_with_halo, sd.grid_size);
-  stde::mdspan next_grid(next_buf.data(), rows_with_halo, sd.grid_size);
+  stde::mdspan grid(grid_buf.data() + deep * row_words, p.local_rows + 2, row_words);
+
+  /*
+   * Initialize the grid. After a restart the checkpoint holds the whole grid, and we only read the
+   * block of our partition from it.
+   */
+  std::vector<u8> local_bits;
 
-  // Initialize the grid
-  switch (sd.id_type) {
-  case random_id: {
-    std::mt19937_64 rng(sd.random_seed + static_cast<usize>(rank));
-    std::uniform_int_distribution<uint8_t> bit(0, 1);
+  if (!sd.restart_from.empty()) {
+    read_checkpoint(sd.restart_from.c_str(), sd, p, local_bits, comm);
+    unpack_block<Cells>(local_bits, row_words, halo_cols, p, grid_buf.data() + deep * row_words);
+  } else {
+    switch (sd.id_type) {
+    case random_id: {
+      // Every cell draws from its global index, so the grid is the same for any decomposition
+      const u64 seed = sd.random_seed;
 
-    for (usize r = 1; r <= p.local_rows; r++) {
-      for (usize c = 0; c < sd.grid_size; c++) {
-        grid(r, c) = bit(rng);
+#pragma omp parallel for default(none) schedule(static) shared(p, grid, halo_cols, seed, sd)
+      for (usize r = 1; r <= p.local_rows; r++) {
+        auto *row = &grid(r, 0);
+        const auto first = (p.row_offset + r - 1) * sd.grid_size + p.col_offset;
+
+        random_words(seed, first, p.local_cols, [&](usize c, u64 bits, usize n) {
+          Cells::set_cells(row, halo_cols + c, bits, n);
+        });
       }
+
+      break;
     }
 
-    break;
-  }
+    case file_id:
+      read_pattern(sd.pattern_path.c_str(), sd, p, local_bits, comm);
+      unpack_block<Cells>(local_bits, row_words, halo_cols, p, grid_buf.data() + deep * row_words);
+      break;
 
-  case glider_id:
-    grid(1, 0) = 0;
-    grid(1, 1) = 1;
-    grid(1, 2) = 0;
+    case glider_id:
+      Cells::set(&grid(1, 0), halo_cols + 0, 0);
+      Cells::set(&grid(1, 0), halo_cols + 1, 1);
+      Cells::set(&grid(1, 0), halo_cols + 2, 0);
 
-    grid(2, 0) = 0;
-    grid(2, 1) = 0;
-    grid(2, 2) = 1;
+      Cells::set(&grid(2, 0), halo_cols + 0, 0);
+      Cells::set(&grid(2, 0), halo_cols + 1, 0);
+      Cells::set(&grid(2, 0), halo_cols + 2, 1);
 
-    grid(3, 0) = 1;
-    grid(3, 1) = 1;
-    grid(3, 2) = 1;
+      Cells::set(&grid(3, 0), halo_cols + 0, 1);
+      Cells::set(&grid(3, 0), halo_cols + 1, 1);
+      Cells::set(&grid(3, 0), halo_cols + 2, 1);
 
-    break;
+      break;
+    }
   }
 
   // Get the ranks of up and down neighbours
   const int up = (rank - 1 + size) % size;
   const int down = (rank + 1) % size;
 
-  // Loop over generations
-  for (usize step = 0; step < sd.generations; step++) {
-    /*
-     * Post non-blocking receives for halos:
-     * Receive top halo (row 0) from neighbor 'up' (they will send their bottom data row)
-     * Receive bottom halo (row local_rows + 1) from neighbor 'down' (they will send their top data
-     * row).
-     */
-    MPI_Request reqs[4];
-    MPI_Irecv(row_ptr(sd, grid_buf.data(), 0), static_cast<int>(sd.grid_size), MPI_UNSIGNED_CHAR,
-              up, 0, MPI_COMM_WORLD, &reqs[0]);
-    MPI_Irecv(row_ptr(sd, grid_buf.data(), p.local_rows + 1), static_cast<int>(sd.grid_size),
-              MPI_UNSIGNED_CHAR, down, 1, MPI_COMM_WORLD, &reqs[1]);
+  const auto row_type = Cells::mpi_type();
 
-    /*
-     * Post non-blocking sends for the rows we have and our neighbours will need.
-     * Send our bottom data row (row p.local_rows) to 'down' with tag 0 (so that down receives into
-     * its top halo)
-     * Send our top real row (row 1) to 'up' with tag 1 (so that up receives into its bottom halo)
-     */
-    MPI_Isend(row_ptr(sd, grid_buf.data(), p.local_rows), static_cast<int>(sd.grid_size),
-              MPI_UNSIGNED_CHAR, down, 0, MPI_COMM_WORLD, &reqs[2]);
-    MPI_Isend(row_ptr(sd, grid_buf.data(), 1), static_cast<int>(sd.grid_size), MPI_UNSIGNED_CHAR,
-              up, 1, MPI_COMM_WORLD, &reqs[3]);
+  // With 2D blocks we have 8 neighbours instead of 2, see BlockHalo
+  BlockHalo block_halo;
+  if (blocks) {
+    block_halo = make_block_halo(comm, p, row_type);
+  }
 
-    /*
-     * Wait for all four operations to complete before computing
-     * Note that we ignore the status of the communications and don't check for possible errors.
-     * What could go wrong after all? :)
-     *
-     * Is there anything we could do to improve this design?
-     */
-    MPI_Waitall(4, reqs, MPI_STATUSES_IGNORE);
+  // Rows of our neighbours that the shared halo exchange reads in place of our halo rows
+  const word *halo_above = nullptr;
+  const word *halo_below = nullptr;
 
-    /*
-     * We have all the data we need. We can now compute the next generation in the game.
-     * Remember that we update only the local data (the non halo cells) and use the halo cells when
-     * necessary.
-     */
-    for (usize r = 1; r <= p.local_rows; r++) {
-      for (usize c = 0; c < sd.grid_size; c++) {
-        // Periodic row boundary condition
-        int left = (c == 0) ? static_cast<int>(sd.grid_size - 1) : static_cast<int>(c - 1);
-        int right = (c + 1 == sd.grid_size) ? 0 : static_cast<int>(c + 1);
-
-        int nsum = 0;
-        // three rows: r-1, r, r+1
-        nsum += grid(r - 1, left);
-        nsum += grid(r - 1, c);
-        nsum += grid(r - 1, right);
-
-        nsum += grid(r, left);
-        // skip grid(r,c) itself
-        nsum += grid(r, right);
-
-        nsum += grid(r + 1, left);
-        nsum += grid(r + 1, c);
-        nsum += grid(r + 1, right);
-
-        u8 cur = grid(r, c);
-        u8 nxt = 0;
-
-        if (cur == 1) {
-          // live cell: survives with 2 or 3 neighbors
-          nxt = (nsum == 2 || nsum == 3) ? 1 : 0;
-        } else {
-          // dead cell: becomes live if exactly 3 neighbors
-          nxt = (nsum == 3) ? 1 : 0;
-        }
+  /*
+   * Compute the next state of the `count` data columns of buffer row `b` starting at data column
+   * `first`. Buffer rows count from the start of the buffer, including the deep halo rows.
+   */
+  const auto update_buffer_row = [&](usize b, usize first, usize count) {
+    const word *above = row_ptr(grid_buf.data(), row_words, b - 1);
+    const word *mid = row_ptr(grid_buf.data(), row_words, b);
+    const word *below = row_ptr(grid_buf.data(), row_words, b + 1);
+    auto *out = row_ptr(next_buf.data(), row_words, b);
+
+    if (b == deep + 1 && halo_above != nullptr) {
+      above = halo_above;
+    }
+    if (b == deep + p.local_rows && halo_below != nullptr) {
+      below = halo_below;
+    }
 
-        next_grid(r, c) = nxt;
+    // With halo columns there is no periodic wrap to take care of inside the row
+    if constexpr (Cells::block_support) {
+      if (blocks) {
+        Cells::update_halo_row(rule, above + first, mid + first, below + first, out + first,
+                               count);
+        return;
       }
     }
 
-    // Diagnostics
-    if (step % sd.stats_every == 0) {
-      long local_sum = 0;
-      for (usize r = 1; r <= p.local_rows; ++r) {
-        for (usize c = 0; c < sd.grid_size; ++c) {
-          local_sum += grid(r, c);
+    if (first == 0 && count == sd.grid_size) {
+      Cells::update_row(rule, above, mid, below, out, sd.grid_size);
+    } else {
+      Cells::update_span(rule, above, mid, below, out, sd.grid_size, first, count);
+    }
+  };
+
+  /*
+   * Live cells, births and deaths of the generation we compute. Instead of sweeping the grid again
+   * to count them, we count each span as soon as it is computed, while its old and new rows are
+   * still in cache. Every OpenMP thread adds to its own slot, which fills a cache line so that
+   * threads don't write to the same line. We only count when `counting` is set.
+   */
+  struct alignas(64) ThreadCounts {
+    CellCounts counts;
+  };
+  std::vector<ThreadCounts> thread_counts(static_cast<usize>(omp_get_max_threads()));
+  bool counting = false;
+
+  const auto tally_rows = [&](usize r, usize rows, usize first, usize count) {
+    const auto w0 = (halo_cols + first) / Cells::cells_per_word;
+    const auto w1 = (halo_cols + first + count - 1) / Cells::cells_per_word + 1;
+    auto &counts = thread_counts[static_cast<usize>(omp_get_thread_num())].counts;
+
+    for (usize b = deep + r; b < deep + r + rows; b++) {
+      Cells::tally(row_ptr(grid_buf.data(), row_words, b), row_ptr(next_buf.data(), row_words, b),
+                   w0, w1, counts);
+    }
+  };
+
+  // The same for data row r, which also counts its cells
+  const auto update_row = [&](usize r, usize first, usize count) {
+    update_buffer_row(deep + r, first, count);
+
+    if (counting) {
+      tally_rows(r, 1, first, count);
+    }
+  };
+
+  // The same for `rows` data rows starting at r. Policies that update rows in pairs take two.
+  const auto update_rows = [&](usize r, usize rows, usize first, usize count) {
+    if constexpr (Cells::rows_per_update == 2) {
+      if (rows == 2) {
+        const auto b = deep + r;
+        Cells::update_pair(rule, row_ptr(grid_buf.data(), row_words, b - 1),
+                           row_ptr(grid_buf.data(), row_words, b),
+                           row_ptr(grid_buf.data(), row_words, b + 1),
+                           row_ptr(grid_buf.data(), row_words, b + 2),
+                           row_ptr(next_buf.data(), row_words, b),
+                           row_ptr(next_buf.data(), row_words, b + 1), sd.grid_size, first, count);
+
+        if (counting) {
+          tally_rows(r, 2, first, count);
         }
+        return;
       }
+    }
+
+    for (usize i = 0; i < rows; i++) {
+      update_row(r + i, first, count);
+    }
+  };
+
+  // Columns of the interior rows that need no halo data. In rows mode this is the whole row.
+  const usize interior_first = blocks ? 1 : 0;
+  const usize interior_count = blocks ? (p.local_cols > 2 ? p.local_cols - 2 : 0) : p.local_cols;
+
+  /*
+   * The halo exchange talks to the same neighbours about the same rows every generation, so we
+   * describe it once with persistent requests and only start them in the loop. The buffers swap
+   * roles every generation (see the std::swap at the end of the loop), so we need one set of
+   * requests for each of them: set 0 for the buffer that holds the state on even steps and set 1
+   * for the one that holds it on odd steps.
+   */
+  MPI_Request halo_reqs[2][16];
+  MPI_Request empty_sends[2][8];
+  int num_reqs = 0;
+
+  /*
+   * With the neighbourhood collective there are no persistent requests. Each exchange starts a new
+   * collective on whichever buffer holds the current state, see NeighborHalo.
+   */
+  const bool neighbor = (sd.halo_exchange == neighbor_exchange);
+  NeighborHalo neighbor_halo;
 
-      long global_sum = 0;
-      MPI_Reduce(&local_sum, &global_sum, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  /*
+   * Nor with one sided puts, which expose both buffers in windows instead, see RmaHalo. A single
+   * rank would only put to itself, and OpenMPI 4.1 refuses to create a window over our own memory
+   * for a single process, so it keeps the point to point exchange.
+   */
+  const bool rma = (sd.halo_exchange == rma_exchange) && size > 1;
+  RmaHalo rma_halo;
+
+  if (sd.halo_exchange == rma_exchange && !rma && !sd.quiet) {
+    root_println("Note: the rma halo exchange needs more than one rank, using p2p instead");
+  }
 
-      root_println("Iteration {}. Live cells {}", step, global_sum);
+  // Generation at which set 0 belongs to grid_buf. The requests are bound again when rows move.
+  auto bound_step = sd.first_step;
+
+  const auto init_halos = [&] {
+    if (neighbor) {
+      neighbor_halo = blocks ? make_block_neighbor_halo(block_halo, comm)
+                             : make_row_neighbor_halo<word>(row_words, sd.halo_depth, p, row_type,
+                                                            up, down, comm);
+      return;
     }
 
-    /*
-     * Save data to disk. All processes dump their local portions of the grid but we save the file
-     * with coordinates relative to the  global grid. This makes it easier for us to plot the state.
-     */
-    if (step % sd.data_every == 0) {
-      auto out_file = fopen(fmt::format("gol_it_{:08}_rank_{:08}.dat", step, rank).c_str(), "w");
+    if (rma) {
+      word *bufs[2] = {grid_buf.data(), next_buf.data()};
+      rma_halo = blocks ? make_block_rma_halo(bufs, grid_buf.size(), block_halo, p, row_type, comm)
+                        : make_row_rma_halo(bufs, grid_buf.size(), row_words, sd.halo_depth, p,
+                                            row_type, up, down, comm);
+      return;
+    }
+
+    // Neighbours on other nodes still get messages, so the requests are set up as usual
+    if (shared) {
+      connect_shared_halo(shared_halo, row_words, p, up, down, comm);
+    }
+
+    for (int parity = 0; parity < 2; parity++) {
+      auto *buf = (parity == 0) ? grid_buf.data() : next_buf.data();
+      auto *empty = sd.sparse ? empty_sends[parity] : nullptr;
+
+      if (blocks) {
+        num_reqs = init_block_halos(buf, block_halo, comm, halo_reqs[parity], empty);
+      } else {
+        num_reqs = init_row_halos(buf, row_words, sd.halo_depth, p, row_type, up, down, comm,
+                                  halo_reqs[parity], empty);
+      }
+    }
+  };
+
+  init_halos();
 
-      fmt::println(out_file, "#1:row    2:col    3:state");
+  // Receives come first in the request sets, then the sends
+  const int num_recvs = num_reqs / 2;
 
-      for (std::size_t r = 1; r <= p.local_rows; ++r) {
-        for (std::size_t c = 0; c < sd.grid_size; ++c) {
-          const auto global_r = p.row_offset + (r - 1);
-          fmt::println(out_file, "{}    {}    {}", global_r, c, grid(r, c));
+  const auto free_halos = [&] {
+    if (neighbor) {
+      free_neighbor_halo(neighbor_halo);
+      return;
+    }
+
+    if (rma) {
+      free_rma_halo(rma_halo);
+      return;
+    }
+
+    for (auto &reqs : halo_reqs) {
+      for (int i = 0; i < num_reqs; i++) {
+        MPI_Request_free(&reqs[i]);
+      }
+    }
+
+    if (sd.sparse) {
+      for (auto &sends : empty_sends) {
+        for (int i = 0; i < num_reqs - num_recvs; i++) {
+          MPI_Request_free(&sends[i]);
         }
       }
+    }
 
-      fclose(out_file);
+    // This also frees our buffers, which live in the window
+    if (shared) {
+      free_shared_halo(shared_halo);
     }
+  };
 
-    /*
-     * Swap the scratch buffer with the current state buffer
-     * Note that we are alswo swapping the halos. That does not matter, as they get written with the
-     * correct data on every iteration.
-     */
-    std::swap(grid_buf, next_buf);
+  /*
+   * Sparse mode, see tiles.hpp. Packed rows compute whole words, so their tiles are a whole number
+   * of words wide.
+   */
+  const auto tile_cols = (sd.tile_cols + Cells::cells_per_word - 1) / Cells::cells_per_word
+                         * Cells::cells_per_word;
+  auto tiles = make_tiles(p, sd.tile_rows, tile_cols, !blocks);
+  SparseStats sparse_stats;
+
+  // Direction (rows, columns) of the i-th halo we receive and of the i-th region we send
+  const auto recv_direction = [&](int i) {
+    return blocks ? BlockHalo::directions[i] : RowHalo::recv_directions[i];
+  };
+  const auto send_direction = [&](int i) {
+    return blocks ? BlockHalo::directions[i] : RowHalo::send_directions[i];
+  };
+
+  // Whether the region we send in direction `dir` changed in the last generation
+  const auto send_region_changed = [&](const int *dir) {
+    const auto last_band = tiles.bands - 1;
+    const auto last_column = tiles.columns - 1;
+
+    return any_changed(tiles, dir[0] == 1 ? last_band : 0, dir[0] == -1 ? 0 : last_band,
+                       dir[1] == 1 ? last_column : 0, dir[1] == -1 ? 0 : last_column);
+  };
+
+  /*
+   * An empty message means the halo in direction `dir` is the same as in the last generation. We
+   * received that one into the other buffer, whose halos are never written by the update, so we
+   * copy it from there.
+   */
+  const auto reuse_halo = [&](const int *dir) {
+    const auto r0 = (dir[0] == -1) ? 0 : ((dir[0] == 1) ? p.local_rows + 1 : 1);
+    const auto rows = (dir[0] == 0) ? p.local_rows : 1;
+    const auto c0 = (dir[1] == -1) ? 0 : ((dir[1] == 1) ? row_words - 1 : halo_cols);
+    const auto words = (dir[1] == 0) ? row_words - 2 * halo_cols : 1;
+
+    for (usize r = r0; r < r0 + rows; r++) {
+      std::copy_n(row_ptr(next_buf.data(), row_words, deep + r) + c0, words,
+                  row_ptr(grid_buf.data(), row_words, deep + r) + c0);
+    }
+  };
+
+  /*
+   * Update a span of a row like update_row, and tell whether any of its cells changed. The words
+   * we compare hold exactly the cells of the span, since spans of packed rows are whole words.
+   */
+  const auto update_tracked = [&](usize r, usize first, usize count) {
+    update_row(r, first, count);
+
+    const auto w0 = (halo_cols + first) / Cells::cells_per_word;
+    const auto w1 = (halo_cols + first + count - 1) / Cells::cells_per_word + 1;
+    const auto *old_row = row_ptr(grid_buf.data(), row_words, deep + r);
+    const auto *new_row = row_ptr(next_buf.data(), row_words, deep + r);
+
+    return !std::equal(new_row + w0, new_row + w1, old_row + w0);
+  };
+
+
+  // Phases of all generations of the run, and of those since the last report of timers_every
+  PhaseTimers phase_total;
+  PhaseTimers phase_window;
+  usize window_first = sd.first_step;
 
-    // We swapped buffer pointers, so let's not forget to update our views!
-    grid = stde::mdspan(grid_buf.data(), rows_with_halo, sd.grid_size);
-    next_grid = stde::mdspan(next_buf.data(), rows_with_halo, sd.grid_size);
+  // Whether every checkpoint made it to disk. A failed one leaves the previous one in place
+  bool checkpointed = true;
+
+  // Time spent computing since the last load balancing check
+  long compute_ns = 0;
+
+  /*
+   * Snapshots go to disk with collective MPI-IO, either with nonblocking writes from staging
+   * buffers or with blocking ones. Both produce the same file. With density maps or the delta
+   * stream we write those instead, see density.hpp and delta_stream.hpp. The trials of the scaling
+   * mode write nothing at all.
+   */
+  AsyncSnapshotWriter async_snapshots;
+  SnapshotWriter snapshots;
+  DensityWriter density;
+  DeltaStream stream;
+  const bool output = !sd.quiet;
+  const auto first_frame = output ? frames_before(sd.first_step, sd.data_every) : 0;
+  const bool maps = output && (sd.density_block > 0);
+  const bool deltas = output && (sd.keyframe_every > 0);
+  const bool async = output && sd.async_output && !maps && !deltas;
+
+  bool opened = true;
+
+  if (maps) {
+    opened = open_density(density, "gol_density.bin", first_frame, sd, comm);
+  } else if (deltas) {
+    opened = open_delta_stream(stream, "gol_stream.bin", "gol_stream.idx", first_frame, sd, p,
+                               comm);
+  } else if (async) {
+    opened = open_async_snapshots(async_snapshots, "gol_snapshots.bin", first_frame,
+                                  sd.queue_depth, sd, p, comm);
+  } else if (output) {
+    opened = open_snapshots(snapshots, "gol_snapshots.bin", first_frame, sd, p, comm);
   }
 
-  MPI_Finalize();
-  return 0;
-}
\ No newline at end of file
+  // All ranks know whether the output could be opened, so they all stop here together
+  if (!opened) {
+    free_halos();
+
+    if (blocks) {
+      free_block_halo(block_halo);
+    }
+
+    return EXIT_FAILURE;
+  }
+
+  // Live cells of our data rows, the slow way
+  const auto count_live = [&] {
+    long local_sum = 0;
+
+#pragma omp parallel for default(none) schedule(static) shared(p, grid, halo_cols)                 \
+    reduction(+ : local_sum)
+    for (usize r = 1; r <= p.local_rows; ++r) {
+      local_sum += Cells::count_live(&grid(r, halo_cols), p.local_cols);
+    }
+
+    return local_sum;
+  };
+
+  /*
+   * Live cells of the generation in grid_buf. Sparse mode only counts the tiles it updates, so it
+   * counts every generation and keeps this up to date with the births and deaths. Otherwise we
+   * count whole generations, and only those we report.
+   */
+  long live = count_live();
+  std::deque<PendingStats> pending_stats;
+
+  if (!sd.quiet && sd.first_step < sd.generations && sd.first_step % sd.stats_every == 0) {
+    post_stats(pending_stats, sd.first_step, CellCounts{live, 0, 0}, true, comm);
+  }
+
+  /*
+   * Load balancing, see balance.hpp. All ranks share their compute time and number of rows, so they
+   * all come to the same new split. If the slowest rank is within balance_tolerance of the mean,
+   * or the split does not change, nothing moves. Otherwise our rows go to their new owners and
+   * everything that depends on our partition is set up again for the new rows: the buffers, the
+   * persistent halo requests, the tiles and the part of the snapshots we write.
+   */
+  const auto rebalance = [&](usize step) {
+    const double local[2] = {static_cast<double>(compute_ns), static_cast<double>(p.local_rows)};
+    std::vector<double> all(2 * static_cast<usize>(size));
+    MPI_Allgather(local, 2, MPI_DOUBLE, all.data(), 2, MPI_DOUBLE, comm);
+    compute_ns = 0;
+
+    std::vector<double> cost(static_cast<usize>(size));
+    std::vector<usize> rows(static_cast<usize>(size));
+    for (usize i = 0; i < cost.size(); i++) {
+      cost[i] = all[2 * i];
+      rows[i] = static_cast<usize>(all[2 * i + 1]);
+    }
+
+    const auto slowest = *std::max_element(cost.begin(), cost.end());
+    const auto mean = std::accumulate(cost.begin(), cost.end(), 0.0) / size;
+
+    if (slowest <= mean * (1.0 + sd.balance_tolerance)) {
+      return;
+    }
+
+    // Deep halos come from a single neighbour, so each rank keeps at least halo_depth rows
+    const auto balanced = balance_rows(rows, cost, sd.halo_depth);
+    if (balanced == rows) {
+      return;
+    }
+
+    pack_block<Cells>(grid_buf.data() + deep * row_words, row_words, halo_cols, p, local_bits);
+    std::vector<u8> moved_bits;
+    migrate_rows(local_bits, rows, moved_bits, balanced, packed_row_bytes(p.local_cols), comm);
+
+    free_halos();
+
+    p = partition_from_rows(balanced, sd.grid_size, rank);
+    allocate_buffers();
+    unpack_block<Cells>(moved_bits, row_words, halo_cols, p, grid_buf.data() + deep * row_words);
+    grid = stde::mdspan(grid_buf.data() + deep * row_words, p.local_rows + 2, row_words);
+
+    init_halos();
+    bound_step = step;
+
+    // Nothing is known about the new rows, so sparse mode starts over with every tile changed
+    if (sd.sparse) {
+      tiles = make_tiles(p, sd.tile_rows, tile_cols, !blocks);
+      live = count_live();
+    }
+
+    if (async) {
+      repartition_async_snapshots(async_snapshots, p);
+    } else if (deltas) {
+      repartition_delta_stream(stream, p);
+    } else if (output && !maps) {
+      repartition_snapshots(snapshots, p);
+    }
+
+    if (sd.quiet) {
+      return;
+    }
+
+    root_println("Generation {}: slowest rank {:.1f}% above the mean, rows per rank now {} to {}",
+                 step, 100.0 * (slowest / mean - 1.0),
+                 *std::min_element(balanced.begin(), balanced.end()),
+                 *std::max_element(balanced.begin(), balanced.end()));
+  };
+
+  // Loop over generations
+  for (usize step = sd.first_step; step < sd.generations; step++) {
+    const auto generation_start = std::chrono::steady_clock::now();
+    PhaseTimers generation;
+
+    // The grid holds generation `step` and no halo exchange is in flight, so our rows may move
+    if (sd.balance_every > 0 && step > sd.first_step
+        && (step - sd.first_step) % sd.balance_every == 0) {
+      rebalance(step);
+      generation.ns[balance_phase] = elapsed_ns(generation_start, std::chrono::steady_clock::now());
+    }
+
+    // The first set of requests is bound to the buffers in the order they start the loop with
+    const auto parity = (step - bound_step) % 2;
+    MPI_Request neighbor_req = MPI_REQUEST_NULL;
+    auto *reqs = neighbor ? &neighbor_req : halo_reqs[parity];
+
+    // Count the generation we compute if we report it, see thread_counts
+    const auto report
+        = !sd.quiet && (step + 1) % sd.stats_every == 0 && step + 1 < sd.generations;
+    counting = report || sd.sparse;
+
+    if (counting) {
+      for (auto &slot : thread_counts) {
+        slot.counts = CellCounts{};
+      }
+    }
+
+    /*
+     * Deep halos: we exchange halo_depth rows with each neighbour, and then advance halo_depth
+     * generations before exchanging again. Each generation the outermost valid halo row goes
+     * stale, since its outer neighbour row is missing, but everything inside it can still be
+     * computed. So we also update the `extra` deep halo rows that remain valid after this
+     * generation, and after halo_depth generations we are left with exactly our data rows. This
+     * trades a few redundant rows for halo_depth times fewer messages.
+     */
+    const auto phase = (step - bound_step) % sd.halo_depth;
+    const auto extra = sd.halo_depth - 1 - phase;
+    int active_reqs = (phase == 0) ? (neighbor ? 1 : num_reqs) : 0;
+
+    /*
+     * In sparse mode a region that did not change in the last generation goes out as an empty
+     * message, which tells the neighbour to keep the halo it already has.
+     */
+    MPI_Request sparse_reqs[16];
+    MPI_Status halo_status[16];
+    auto *statuses = sd.sparse ? halo_status : MPI_STATUSES_IGNORE;
+
+    if (sd.sparse) {
+      for (int i = 0; i < num_reqs; i++) {
+        const auto send = i - num_recvs;
+        const auto skip = send >= 0 && !send_region_changed(send_direction(send));
+
+        sparse_reqs[i] = skip ? empty_sends[parity][send] : reqs[i];
+        sparse_stats.sends_skipped += skip ? 1 : 0;
+      }
+
+      sparse_stats.sends += num_reqs - num_recvs;
+      reqs = sparse_reqs;
+    }
+
+    /*
+     * With the shared halo exchange only the neighbours on other nodes get messages. We read the
+     * boundary rows of the others in their current buffer, which has the same parity as ours.
+     */
+    MPI_Request shared_reqs[4];
+
+    if (shared) {
+      const auto side = [](const int *dir) { return (dir[0] == -1) ? 0 : 1; };
+
+      active_reqs = 0;
+      for (int i = 0; i < num_reqs; i++) {
+        const auto *dir = (i < num_recvs) ? recv_direction(i) : send_direction(i - num_recvs);
+        if (!shared_halo.on_node[side(dir)]) {
+          shared_reqs[active_reqs++] = reqs[i];
+        }
+      }
+      reqs = shared_reqs;
+
+      halo_above = shared_halo.on_node[0] ? shared_halo.their_row[0][parity] : nullptr;
+      halo_below = shared_halo.on_node[1] ? shared_halo.their_row[1][parity] : nullptr;
+    }
+
+    /*
+     * Start, test and wait for the halo exchange of this generation. The requests cover the point
+     * to point and the collective exchanges, while one sided puts complete with their window.
+     */
+    const auto exchanging = (phase == 0);
+    const auto win = rma ? rma_halo.win[parity] : MPI_WIN_NULL;
+
+    const auto start_halos = [&] {
+      if (shared) {
+        publish_generation(shared_halo, step);
+      }
+
+      if (rma && exchanging) {
+        start_rma_halo(grid_buf.data(), rma_halo, static_cast<int>(parity));
+      } else if (neighbor && exchanging) {
+        start_neighbor_halo(grid_buf.data(), neighbor_halo, &neighbor_req);
+      } else {
+        MPI_Startall(active_reqs, reqs);
+      }
+    };
+
+    const auto test_halos = [&] {
+      int done = 0;
+      if (rma && exchanging) {
+        MPI_Win_test(win, &done);
+      } else {
+        MPI_Testall(active_reqs, reqs, &done, statuses);
+      }
+      return (done != 0 && (!shared || neighbours_ready(shared_halo, step))) ? 1 : 0;
+    };
+
+    const auto wait_halos = [&] {
+      if (rma && exchanging) {
+        MPI_Win_wait(win);
+      } else {
+        MPI_Waitall(active_reqs, reqs, statuses);
+      }
+
+      while (shared && !neighbours_ready(shared_halo, step)) {
+        std::this_thread::yield();
+      }
+    };
+
+    const auto post_time = std::chrono::steady_clock::now();
+    start_halos();
+
+    /*
+     * Rows 2..local_rows-1 only read our own data rows, so we can compute them while the halos are
+     * still in flight. After each row we poke MPI with test_halos(). This gives the library a
+     * chance to progress the messages and tells us when they arrived, which we use to see how much
+     * of the communication we managed to hide.
+     *
+     * Note that we ignore the status of the communications and don't check for possible errors.
+     * What could go wrong after all? :)
+     */
+    int halos_done = 0;
+    auto halos_done_time = post_time;
+
+    /*
+     * The interior rows are split among the OpenMP threads of this rank. MPI was initialized with
+     * MPI_THREAD_FUNNELED, so only the main thread (thread 0 of the team) may test the halos.
+     */
+    if (sd.sparse) {
+      /*
+       * Same thing one tile at a time, skipping the quiet ones. Busy and quiet tiles take very
+       * different times, so they are handed out dynamically.
+       */
+      long tiles_updated = 0;
+
+#pragma omp parallel for default(none) schedule(dynamic)                                           \
+    shared(p, tiles, update_tracked, interior_first, interior_count, halos_done, halos_done_time,  \
+               test_halos) reduction(+ : tiles_updated)
+      for (usize t = 0; t < tiles.bands * tiles.columns; t++) {
+        const auto i = t / tiles.columns;
+        const auto j = t % tiles.columns;
+
+        if (near_change(tiles, i, j)) {
+          tiles_updated++;
+
+          const auto r0 = std::max(usize{2}, 1 + i * tiles.tile_rows);
+          const auto r1 = std::min(p.local_rows, 1 + (i + 1) * tiles.tile_rows);
+          const auto c0 = std::max(interior_first, j * tiles.tile_cols);
+          const auto c1 = std::min(interior_first + interior_count, (j + 1) * tiles.tile_cols);
+
+          bool changed = false;
+          for (usize r = r0; r < r1 && c0 < c1; r++) {
+            changed = update_tracked(r, c0, c1 - c0) || changed;
+          }
+
+          if (changed) {
+            tiles.next_changed[t] = 1;
+          }
+        }
+
+        if (omp_get_thread_num() == 0 && halos_done == 0) {
+          halos_done = test_halos();
+          halos_done_time = std::chrono::steady_clock::now();
+        }
+      }
+
+      sparse_stats.tiles += static_cast<long>(tiles.bands * tiles.columns);
+      sparse_stats.tiles_updated += tiles_updated;
+    } else {
+      // Rows go out in groups of rows_per_update. The last group may be short.
+      const auto group = Cells::rows_per_update;
+      const auto interior_rows = (p.local_rows > 2) ? p.local_rows - 2 : 0;
+      const auto groups = (interior_rows + group - 1) / group;
+
+#pragma omp parallel for default(none) schedule(static)                                            \
+    shared(p, update_rows, interior_first, interior_count, halos_done, halos_done_time,            \
+               test_halos, group, interior_rows, groups)
+      for (usize g = 0; g < groups; g++) {
+        const auto r = 2 + g * group;
+        update_rows(r, std::min(group, interior_rows - g * group), interior_first, interior_count);
+
+        if (omp_get_thread_num() == 0 && halos_done == 0) {
+          halos_done = test_halos();
+          halos_done_time = std::chrono::steady_clock::now();
+        }
+      }
+    }
+
+    const auto interior_time = std::chrono::steady_clock::now();
+
+    // Whatever is still in flight now can't be hidden anymore
+    if (halos_done == 0) {
+      wait_halos();
+      halos_done_time = std::chrono::steady_clock::now();
+    }
+
+    const auto wait_time = std::chrono::steady_clock::now();
+
+    // Which sides of our halo changed since the last generation. Corners count for both sides.
+    bool halo_top = false, halo_bottom = false, halo_left = false, halo_right = false;
+
+    if (sd.sparse) {
+      for (int i = 0; i < num_recvs; i++) {
+        const auto *dir = recv_direction(i);
+
+        int count = 0;
+        MPI_Get_count(&halo_status[i], blocks ? block_halo.recv_type[i] : row_type, &count);
+
+        if (count == 0) {
+          reuse_halo(dir);
+          continue;
+        }
+
+        halo_top = halo_top || dir[0] == -1;
+        halo_bottom = halo_bottom || dir[0] == 1;
+        halo_left = halo_left || dir[1] == -1;
+        halo_right = halo_right || dir[1] == 1;
+      }
+    }
+
+    /*
+     * We have all the data we need. We can now compute the cells that read halo data: the first and
+     * last data rows and, with 2D blocks, the first and last data columns of the interior rows.
+     */
+    if (sd.sparse) {
+      const usize boundary_rows[2] = {1, p.local_rows};
+
+      for (usize k = 0; k < (p.local_rows > 1 ? 2 : 1); k++) {
+        const auto r = boundary_rows[k];
+        const auto i = band_of(tiles, r);
+        const auto halo_changed = (r == 1 && halo_top) || (r == p.local_rows && halo_bottom);
+
+#pragma omp parallel for default(none) schedule(dynamic)                                           \
+    shared(p, tiles, update_tracked, r, i, halo_changed, halo_left, halo_right)
+        for (usize j = 0; j < tiles.columns; j++) {
+          const auto side_changed = (j == 0 && halo_left) || (j + 1 == tiles.columns && halo_right);
+
+          if (near_change(tiles, i, j) || halo_changed || side_changed) {
+            const auto c0 = j * tiles.tile_cols;
+            const auto c1 = std::min(p.local_cols, (j + 1) * tiles.tile_cols);
+
+            if (update_tracked(r, c0, c1 - c0)) {
+              tiles.next_changed[i * tiles.columns + j] = 1;
+            }
+          }
+        }
+      }
+
+      if (blocks) {
+#pragma omp parallel for default(none) schedule(dynamic)                                           \
+    shared(p, tiles, update_tracked, halo_left, halo_right)
+        for (usize i = 0; i < tiles.bands; i++) {
+          const auto r0 = std::max(usize{2}, 1 + i * tiles.tile_rows);
+          const auto r1 = std::min(p.local_rows, 1 + (i + 1) * tiles.tile_rows);
+          const auto last = tiles.columns - 1;
+
+          if (near_change(tiles, i, 0) || halo_left) {
+            for (usize r = r0; r < r1; r++) {
+              if (update_tracked(r, 0, 1)) {
+                tiles.next_changed[i * tiles.columns] = 1;
+              }
+            }
+          }
+
+          if (p.local_cols > 1 && (near_change(tiles, i, last) || halo_right)) {
+            for (usize r = r0; r < r1; r++) {
+              if (update_tracked(r, p.local_cols - 1, 1)) {
+                tiles.next_changed[i * tiles.columns + last] = 1;
+              }
+            }
+          }
+        }
+      }
+    } else {
+      update_row(1, 0, p.local_cols);
+
+      if (p.local_rows > 1) {
+        update_row(p.local_rows, 0, p.local_cols);
+      }
+    }
+
+    if (blocks && !sd.sparse) {
+#pragma omp parallel for default(none) schedule(static) shared(p, update_row)
+      for (usize r = 2; r < p.local_rows; r++) {
+        update_row(r, 0, 1);
+
+        if (p.local_cols > 1) {
+          update_row(r, p.local_cols - 1, 1);
+        }
+      }
+    }
+
+    // The deep halo rows that stay valid, above and below our data rows
+    if (extra > 0) {
+#pragma omp parallel for default(none) schedule(static) shared(p, update_buffer_row, deep, extra)
+      for (usize h = 1; h <= extra; h++) {
+        update_buffer_row(deep + 1 - h, 0, p.local_cols);
+        update_buffer_row(deep + p.local_rows + h, 0, p.local_cols);
+      }
+    }
+
+    const auto boundary_time = std::chrono::steady_clock::now();
+
+    compute_ns += elapsed_ns(post_time, interior_time) + elapsed_ns(wait_time, boundary_time);
+
+    generation.ns[compute_phase]
+        = elapsed_ns(post_time, interior_time) + elapsed_ns(wait_time, boundary_time);
+    generation.ns[halo_phase] = elapsed_ns(interior_time, wait_time);
+    generation.halo_flight = elapsed_ns(post_time, halos_done_time);
+    generation.interior = elapsed_ns(post_time, interior_time);
+    generation.exchanges = (phase == 0) ? 1 : 0;
+    generation.rows = static_cast<long>(p.local_rows + 2 * extra);
+
+    // Statistics of generation step + 1, whose reduction we only look at again in a later step
+    if (counting) {
+      CellCounts counts;
+      for (const auto &slot : thread_counts) {
+        counts += slot.counts;
+      }
+
+      // The tiles we skipped have the same live cells as before
+      if (sd.sparse) {
+        counts.live = live + counts.births - counts.deaths;
+      }
+      live = counts.live;
+
+      if (report) {
+        post_stats(pending_stats, step + 1, counts, false, comm);
+      }
+    }
+
+    drain_stats(pending_stats, false, rank);
+
+    const auto stats_time = std::chrono::steady_clock::now();
+    generation.ns[stats_phase] = elapsed_ns(boundary_time, stats_time);
+
+    /*
+     * Save data to disk. All processes write their local portions of the grid into the same frame
+     * of a single binary file. See snapshot.hpp for the format.
+     *
+     * With nonblocking writes we only pay for packing our block into a staging buffer and starting
+     * the write, unless the disk is so far behind that all staging buffers are still in flight.
+     * Density maps only send counts of live cells, which rank 0 writes.
+     */
+    if (output && step % sd.data_every == 0) {
+      if (maps) {
+        count_density(density, p, [&](usize r, usize c) {
+          return Cells::get(&grid(r + 1, 0), halo_cols + c);
+        });
+        write_density(density, step, comm);
+      } else if (deltas) {
+        pack_block<Cells>(grid_buf.data() + deep * row_words, row_words, halo_cols, p, local_bits);
+        write_delta_frame(stream, step, local_bits, comm);
+      } else if (async) {
+        auto &frame = acquire_frame(async_snapshots);
+        pack_block<Cells>(grid_buf.data() + deep * row_words, row_words, halo_cols, p, frame.bits);
+        submit_frame(async_snapshots, step);
+      } else {
+        pack_block<Cells>(grid_buf.data() + deep * row_words, row_words, halo_cols, p, local_bits);
+        write_snapshot(snapshots, step, local_bits);
+      }
+    }
+
+    generation.ns[output_phase] = elapsed_ns(stats_time, std::chrono::steady_clock::now());
+
+    /*
+     * Swap the scratch buffer with the current state buffer
+     * Note that we are alswo swapping the halos. That does not matter, as they get written with the
+     * correct data on every iteration.
+     *
+     * std::swap on vectors only exchanges their data pointers, so the two allocations (and the
+     * persistent requests bound to them) stay valid.
+     */
+    std::swap(grid_buf, next_buf);
+
+    // We swapped buffer pointers, so let's not forget to update our view!
+    grid = stde::mdspan(grid_buf.data() + deep * row_words, p.local_rows + 2, row_words);
+
+    if (sd.sparse) {
+      advance_tiles(tiles);
+    }
+
+    // The grid now holds generation step + 1, which is where a restart from this checkpoint begins
+    if (sd.checkpoint_every > 0 && (step + 1) % sd.checkpoint_every == 0) {
+      const auto checkpoint_time = std::chrono::steady_clock::now();
+      pack_block<Cells>(grid_buf.data() + deep * row_words, row_words, halo_cols, p, local_bits);
+      if (async) {
+        flush_async_snapshots(async_snapshots);
+      }
+      if (!write_checkpoint(sd.checkpoint_path.c_str(), step + 1, sd, p, local_bits, comm)) {
+        root_println("Error: the checkpoint of generation {} failed, {} keeps the previous one",
+                     step + 1, sd.checkpoint_path);
+        checkpointed = false;
+      }
+      generation.ns[output_phase]
+          += elapsed_ns(checkpoint_time, std::chrono::steady_clock::now());
+    }
+
+    generation.total = elapsed_ns(generation_start, std::chrono::steady_clock::now());
+    generation.cells = static_cast<long>(p.local_rows * p.local_cols);
+    generation.generations = 1;
+
+    phase_total += generation;
+    phase_window += generation;
+
+    // A report of the generations so far, unless this is the last one, which gets the full report
+    if (sd.timers_every > 0 && (step + 1) % sd.timers_every == 0 && step + 1 < sd.generations) {
+      report_phases(phase_window, window_first, sd, p, comm);
+      phase_window = PhaseTimers{};
+      window_first = step + 1;
+    }
+  }
+
+  drain_stats(pending_stats, true, rank);
+
+  // Whether every frame of every rank made it to the file
+  bool written = true;
+
+  if (maps) {
+    written = close_density(density, comm);
+  } else if (deltas) {
+    written = close_delta_stream(stream, comm);
+  } else if (async) {
+    written = close_async_snapshots(async_snapshots, comm);
+  } else if (output) {
+    written = close_snapshots(snapshots, comm);
+  }
+
+  free_halos();
+
+  if (blocks) {
+    free_block_halo(block_halo);
+  }
+
+  // The scaling mode times the whole run and reports it, see run_scaling
+  if (sd.quiet) {
+    return EXIT_SUCCESS;
+  }
+
+  if (phase_total.generations > 0) {
+    report_phases(phase_total, sd.first_step, sd, p, comm);
+  }
+
+  if (sd.sparse) {
+    report_sparse(sparse_stats, rank, comm);
+  }
+
+  if (async) {
+    report_async_snapshots(async_snapshots, comm);
+  }
+
+  return written && checkpointed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Run the sweep with the rule of the configuration file. The common rules have kernels of their
+ * own, any other rule goes through the kernels of MaskRule.
+ */
+template <typename Cells>
+static auto run_rule(const SimulationData &sd, const Partition &p, MPI_Comm comm) -> int {
+  if (sd.rule == ConwayRule::masks) {
+    return run<Cells>(sd, ConwayRule{}, p, comm);
+  }
+  if (sd.rule == HighLifeRule::masks) {
+    return run<Cells>(sd, HighLifeRule{}, p, comm);
+  }
+  if (sd.rule == DayNightRule::masks) {
+    return run<Cells>(sd, DayNightRule{}, p, comm);
+  }
+  return run<Cells>(sd, sd.rule, p, comm);
+}
+
+/*
+ * Run the simulation with Hashlife (see hashlife.hpp) instead of sweeping the grid.
+ *
+ * Hashlife is a serial algorithm, so rank 0 runs it alone. It advances straight from one point of
+ * interest to the next, i.e. the next generation at which we print statistics, write a snapshot or
+ * a checkpoint, in as many jumps as that distance has set bits. Statistics, snapshots and
+ * checkpoints are the same as those of the sweep, so both engines can be compared and restarted
+ * from each other.
+ */
+static auto run_hashlife(const SimulationData &sd) -> int {
+  const int rank = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+
+  // The whole grid is a single partition
+  Partition p;
+  p.size = 1;
+  p.local_rows = sd.grid_size;
+  p.local_cols = sd.grid_size;
+
+  const auto row_bytes = packed_row_bytes(sd.grid_size);
+  std::vector<u8> bits(sd.grid_size * row_bytes, 0);
+
+  if (!sd.restart_from.empty()) {
+    read_checkpoint(sd.restart_from.c_str(), sd, p, bits, MPI_COMM_SELF);
+  } else {
+    const auto set = [&](usize r, usize c) {
+      bits[r * row_bytes + c / 8] = static_cast<u8>(bits[r * row_bytes + c / 8] | (1 << (c % 8)));
+    };
+
+    switch (sd.id_type) {
+    case random_id: {
+      // Same grid as the sweep, whatever its decomposition. Bit c of a row is cell c, as in a word
+      for (usize r = 0; r < sd.grid_size; r++) {
+        auto *row = &bits[r * row_bytes];
+        random_words(sd.random_seed, r * sd.grid_size, sd.grid_size, [&](usize c, u64 w, usize n) {
+          for (usize b = 0; b < (n + 7) / 8; b++) {
+            row[c / 8 + b] = static_cast<u8>(w >> (8 * b));
+          }
+        });
+      }
+
+      break;
+    }
+
+    case file_id:
+      read_pattern(sd.pattern_path.c_str(), sd, p, bits, MPI_COMM_SELF);
+      break;
+
+    case glider_id:
+      set(0, 1);
+      set(1, 2);
+      set(2, 0);
+      set(2, 1);
+      set(2, 2);
+
+      break;
+    }
+  }
+
+  Hashlife h;
+  h.rule = sd.rule;
+  auto root = hashlife_from_bits(h, bits, sd.grid_size);
+
+  const auto first_frame = frames_before(sd.first_step, sd.data_every);
+  const bool maps = (sd.density_block > 0);
+  const bool deltas = (sd.keyframe_every > 0);
+  SnapshotWriter snapshots;
+  DensityWriter density;
+  DeltaStream stream;
+
+  bool opened = true;
+
+  if (maps) {
+    opened = open_density(density, "gol_density.bin", first_frame, sd, MPI_COMM_SELF);
+  } else if (deltas) {
+    opened = open_delta_stream(stream, "gol_stream.bin", "gol_stream.idx", first_frame, sd, p,
+                               MPI_COMM_SELF);
+  } else {
+    opened = open_snapshots(snapshots, "gol_snapshots.bin", first_frame, sd, p, MPI_COMM_SELF);
+  }
+
+  if (!opened) {
+    return EXIT_FAILURE;
+  }
+
+  // First multiple of `every` after `step`
+  const auto next_multiple = [](usize step, usize every) { return (step / every + 1) * every; };
+
+  bool checkpointed = true;
+
+  for (usize step = sd.first_step; step < sd.generations;) {
+    if (step % sd.stats_every == 0) {
+      root_println("Iteration {}. Live cells {}", step, h.nodes[root].population);
+    }
+
+    if (step % sd.data_every == 0) {
+      hashlife_to_bits(h, root, sd.grid_size, bits);
+
+      if (maps) {
+        count_density(density, p, [&](usize r, usize c) {
+          return static_cast<u8>((bits[r * row_bytes + c / 8] >> (c % 8)) & 1);
+        });
+        write_density(density, step, MPI_COMM_SELF);
+      } else if (deltas) {
+        write_delta_frame(stream, step, bits, MPI_COMM_SELF);
+      } else {
+        write_snapshot(snapshots, step, bits);
+      }
+    }
+
+    auto next = std::min({sd.generations, next_multiple(step, sd.stats_every),
+                          next_multiple(step, sd.data_every)});
+    if (sd.checkpoint_every > 0) {
+      next = std::min(next, next_multiple(step, sd.checkpoint_every));
+    }
+
+    root = hashlife_advance(h, root, next - step);
+    step = next;
+
+    if (sd.checkpoint_every > 0 && step % sd.checkpoint_every == 0) {
+      hashlife_to_bits(h, root, sd.grid_size, bits);
+      if (!write_checkpoint(sd.checkpoint_path.c_str(), step, sd, p, bits, MPI_COMM_SELF)) {
+        root_println("Error: the checkpoint of generation {} failed, {} keeps the previous one",
+                     step, sd.checkpoint_path);
+        checkpointed = false;
+      }
+    }
+  }
+
+  bool written = true;
+
+  if (maps) {
+    written = close_density(density, MPI_COMM_SELF);
+  } else if (deltas) {
+    written = close_delta_stream(stream, MPI_COMM_SELF);
+  } else {
+    written = close_snapshots(snapshots, MPI_COMM_SELF);
+  }
+
+  const auto end_time = std::chrono::steady_clock::now();
+
+  root_println("Hashlife: {} nodes, {} memoized results, {:.6e} s", h.nodes.size(),
+               h.results.size(), static_cast<double>(elapsed_ns(start_time, end_time)) / 1.0e9);
+
+  return written && checkpointed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Split the grid over the ranks of `comm` with the decomposition of the configuration file, and run
+ * the sweep on it.
+ */
+static auto run_decomposed(const SimulationData &sd, MPI_Comm comm) -> int {
+  int rank = 0, size = 0;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  // Pick the cell representation requested in the configuration file
+  int status = EXIT_SUCCESS;
+
+  if (sd.decomposition == block_decomposition) {
+    if (sd.storage != byte_storage) {
+      root_println("Error: the 2D block decomposition requires byte cell storage");
+      return EXIT_FAILURE;
+    }
+
+    /*
+     * Let MPI choose a balanced 2D process grid and build a periodic Cartesian communicator on it.
+     * We allow MPI to reorder ranks so that neighbours in the process grid may end up close to each
+     * other in the machine.
+     */
+    int dims[2] = {0, 0};
+    const int periods[2] = {1, 1};
+    MPI_Dims_create(size, 2, dims);
+
+    // Every rank needs at least one row and one group of 8 columns, see compute_block_partition
+    const auto max_rows = sd.grid_size;
+    const auto max_cols = packed_row_bytes(sd.grid_size);
+
+    if (static_cast<usize>(dims[0]) > max_rows || static_cast<usize>(dims[1]) > max_cols) {
+      root_println("Error: process grid {} x {} is too large for the grid ({}). At most {} x {} "
+                   "ranks are allowed.",
+                   dims[0], dims[1], sd.grid_size, max_rows, max_cols);
+      return EXIT_FAILURE;
+    }
+
+    MPI_Comm cart_comm = MPI_COMM_NULL;
+    MPI_Cart_create(comm, 2, dims, periods, 1, &cart_comm);
+
+    if (!sd.quiet) {
+      root_println("Using a {} x {} process grid", dims[0], dims[1]);
+    }
+
+    const auto p = compute_block_partition(sd, cart_comm);
+    status = run_rule<ByteCells>(sd, p, cart_comm);
+
+    MPI_Comm_free(&cart_comm);
+    return status;
+  }
+
+  if (static_cast<usize>(size) > sd.grid_size) {
+    root_println("Warning: more MPI ranks ({}) than rows in grid ({}). Behavior will still be "
+                 "periodic but some ranks will get zero rows.",
+                 size, sd.grid_size);
+  }
+
+  /*
+   * Ranks with no data rows would still have to take part in every communication. For simplicity,
+   * we will terminate these ranks and continue on with the ones that do have some data to work on,
+   * in a communicator that only holds those. Ranks with rows are 0..active_size-1 in both
+   * communicators, so their partition does not change.
+   */
+  const auto world_p = compute_partition(sd, rank, size);
+
+  MPI_Comm active_comm = MPI_COMM_NULL;
+  MPI_Comm_split(comm, world_p.local_rows > 0 ? 0 : MPI_UNDEFINED, rank, &active_comm);
+
+  if (world_p.local_rows == 0) {
+    fmt::println(
+        "Rank {} got 0 rows due to grid size ({}) < num. procs ({}). Exiting those ranks.\n", rank,
+        sd.grid_size, size);
+    return EXIT_SUCCESS;
+  }
+
+  int active_size = 0;
+  MPI_Comm_size(active_comm, &active_size);
+
+  const auto p = compute_partition(sd, rank, active_size);
+
+  // The k halo rows we receive from a neighbour must all be rows the neighbour owns
+  if (sd.grid_size / static_cast<usize>(active_size) < sd.halo_depth) {
+    root_println("Error: halo_depth ({}) is larger than the rows of the smallest rank ({})",
+                 sd.halo_depth, sd.grid_size / static_cast<usize>(active_size));
+    MPI_Comm_free(&active_comm);
+    return EXIT_FAILURE;
+  }
+
+  switch (sd.storage) {
+  case byte_storage:
+    status = run_rule<ByteCells>(sd, p, active_comm);
+    break;
+
+  case packed_storage:
+    status = run_rule<PackedCells>(sd, p, active_comm);
+    break;
+
+  case table_storage:
+    status = run_rule<TableCells>(sd, p, active_comm);
+    break;
+  }
+
+  MPI_Comm_free(&active_comm);
+  return status;
+}
+
+// Rows and columns of the grid of a weak scaling trial on `ranks` ranks
+static auto weak_grid_size(usize grid_size, int ranks) -> usize {
+  return static_cast<usize>(
+      std::lround(static_cast<double>(grid_size) * std::sqrt(static_cast<double>(ranks))));
+}
+
+/*
+ * The scaling mode, which collects in a single launch what would otherwise take one launch per
+ * number of ranks. For k = 1, 2, ..., size, the first k ranks of MPI_COMM_WORLD run the
+ * configuration file in a communicator of their own while the others wait. Each run is repeated
+ * scaling_repeats times without statistics or output files, and timed from a barrier before it to a
+ * barrier after it. The time is that of the slowest rank and includes setting up the grid.
+ *
+ * Strong scaling keeps grid_size fixed, so the speedup on k ranks is t(1) / t(k). Weak scaling
+ * keeps the cells per rank fixed with a grid of grid_size * sqrt(k) rows and columns, so ideally
+ * t(k) = t(1), and we report the scaled speedup k t(1) / t(k). The ideal speedup is k for both, and
+ * the efficiency is the speedup over k.
+ *
+ * Rank 0 writes mpi_gol_strong_scaling.dat and mpi_gol_weak_scaling.dat, with the columns of the
+ * scaling files of the pi programs followed by our own, so plot_scaling.gp plots them the same way.
+ */
+static auto run_scaling(const SimulationData &sd, int rank, int size) -> int {
+  auto trial = sd;
+  trial.quiet = true;
+  trial.timers_every = 0;
+  trial.checkpoint_every = 0;
+
+  const char *names[2] = {"strong", "weak"};
+
+  for (int weak = 0; weak < 2; weak++) {
+    root_println("Doing {} scaling testing on 1 to {} ranks ...", names[weak], size);
+
+    std::FILE *out_file = nullptr;
+
+    if (rank == 0) {
+      out_file = fopen(fmt::format("mpi_gol_{}_scaling.dat", names[weak]).c_str(), "w");
+      fmt::println(out_file, "# Grid size on 1 rank: {}", sd.grid_size);
+      fmt::println(out_file, "# Generations: {}", sd.generations);
+      fmt::println(out_file, "# Repeats: {}", sd.scaling_repeats);
+      fmt::println(out_file,
+                   "#1: Ranks    2: Time (ns)    3: Speedup    4: Efficiency    5: Grid size");
+    }
+
+    double first_time_avg = 0.0;
+
+    for (int k = 1; k <= size; k++) {
+      trial.grid_size = weak ? weak_grid_size(sd.grid_size, k) : sd.grid_size;
+
+      MPI_Comm trial_comm = MPI_COMM_NULL;
+      MPI_Comm_split(MPI_COMM_WORLD, rank < k ? 0 : MPI_UNDEFINED, rank, &trial_comm);
+
+      int status = EXIT_SUCCESS;
+      long time_sum = 0;
+
+      if (rank < k) {
+        for (usize j = 0; j < sd.scaling_repeats && status == EXIT_SUCCESS; j++) {
+          MPI_Barrier(trial_comm);
+          const auto start = std::chrono::steady_clock::now();
+
+          status = run_decomposed(trial, trial_comm);
+
+          MPI_Barrier(trial_comm);
+          time_sum += elapsed_ns(start, std::chrono::steady_clock::now());
+        }
+
+        MPI_Comm_free(&trial_comm);
+      }
+
+      // The ranks that waited learn whether the trial failed, e.g. for a halo_depth too large
+      MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+      if (status != EXIT_SUCCESS) {
+        if (rank == 0) {
+          fclose(out_file);
+        }
+        return status;
+      }
+
+      if (rank == 0) {
+        const auto time_avg
+            = static_cast<double>(time_sum) / static_cast<double>(sd.scaling_repeats);
+
+        if (k == 1) {
+          first_time_avg = time_avg;
+        }
+
+        const auto speedup = (weak ? k : 1) * first_time_avg / time_avg;
+        const auto efficiency = speedup / k;
+
+        fmt::println(out_file, "{}    {:.16e}    {:.16e}    {:.16e}    {}", k, time_avg, speedup,
+                     efficiency, trial.grid_size);
+        fmt::println("  {} ranks, grid {}: {:.6e} s, speedup {:.3f}, efficiency {:.3f}", k,
+                     trial.grid_size, time_avg * 1e-9, speedup, efficiency);
+      }
+    }
+
+    if (rank == 0) {
+      fclose(out_file);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Set up the OpenMP side of the hybrid run and check that the ranks per node we got matches what
+ * the configuration file asked for.
+ */
+static void setup_threads(const SimulationData &sd, int rank, int provided) {
+  if (provided < MPI_THREAD_FUNNELED) {
+    root_println("Warning: MPI does not support MPI_THREAD_FUNNELED. Use one thread per rank.");
+  }
+
+  if (sd.threads_per_rank > 0) {
+    omp_set_num_threads(sd.threads_per_rank);
+  }
+
+  // Ranks that can share memory with each other are on the same node
+  MPI_Comm node_comm = MPI_COMM_NULL;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+
+  int node_size = 0;
+  MPI_Comm_size(node_comm, &node_size);
+  MPI_Comm_free(&node_comm);
+
+  root_println("Running {} MPI ranks per node with {} OpenMP threads per rank", node_size,
+               omp_get_max_threads());
+
+  if (sd.ranks_per_node > 0 && sd.ranks_per_node != node_size) {
+    root_println("Warning: expected {} ranks per node but got {}. Check the launcher options.",
+                 sd.ranks_per_node, node_size);
+  }
+}
+
+int main(int argc, char **argv) {
+  /*
+   * The OpenMP threads of a rank never call MPI themselves, only the main thread does. This is
+   * what MPI_THREAD_FUNNELED promises to MPI.
+   */
+  int provided = 0;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+  int rank = 0, size = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  const bool scaling = (argc == 3 && strcmp(argv[2], "--scaling") == 0);
+
+  if (argc != 2 && !scaling) {
+    root_println("Usage: {} <config-file.toml> [--scaling]", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  auto sd = parse_sim_data(argv[1]);
+
+  /*
+   * A restart takes the grid size, the generation and the random seed from the checkpoint. The
+   * partitions below are computed for the ranks of this run, so it does not matter how many ranks
+   * wrote the checkpoint.
+   */
+  if (!sd.restart_from.empty()) {
+    CheckpointHeader header;
+
+    if (!read_checkpoint_header(sd.restart_from.c_str(), header, MPI_COMM_WORLD)) {
+      root_println("Error: {} is not a checkpoint", sd.restart_from);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    sd.grid_size = header.grid_size;
+    sd.first_step = header.step;
+    sd.random_seed = header.random_seed;
+
+    root_println("Restarting from {} at generation {}", sd.restart_from, sd.first_step);
+  }
+
+  // A pattern file must be readable and fit in the grid where it is placed
+  if (sd.restart_from.empty() && sd.id_type == file_id) {
+    PatternInfo info;
+
+    if (!read_pattern_info(sd.pattern_path.c_str(), info, MPI_COMM_WORLD)) {
+      root_println("Error: {} is not an RLE or bitmap pattern", sd.pattern_path);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    if (sd.pattern_row + info.rows > sd.grid_size || sd.pattern_col + info.cols > sd.grid_size) {
+      root_println("Error: the {} x {} pattern at row {} and column {} does not fit in the grid",
+                   info.rows, info.cols, sd.pattern_row, sd.pattern_col);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!parse_rule(sd.rule_text.c_str(), sd.rule)) {
+    root_println("Error: {} is not a rule in B/S notation, like B3/S23", sd.rule_text);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  setup_threads(sd, rank, provided);
+
+  if (sd.async_output && sd.queue_depth == 0) {
+    root_println("Error: nonblocking snapshot writes need a queue_depth of at least 1");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  if (sd.density_block > 0 && sd.keyframe_every > 0) {
+    root_println("Error: density maps and the delta stream both replace the snapshots, pick one");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  if (sd.stats_every == 0 || sd.data_every == 0) {
+    root_println("Error: stats_every and data_every must be at least 1");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  if (sd.halo_depth == 0) {
+    root_println("Error: halo_depth must be at least 1");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  // Deep halos are only implemented for the plain sweep over the row decomposition
+  if (sd.halo_depth > 1
+      && (sd.engine != sweep_engine || sd.decomposition != row_decomposition || sd.sparse)) {
+    root_println("Error: a halo_depth above 1 needs the sweep engine, the row decomposition and "
+                 "sparse mode disabled");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  // Sparse mode tells quiet halos by their empty messages, which only the p2p exchange has
+  if (sd.halo_exchange != p2p_exchange && sd.sparse) {
+    root_println("Error: sparse mode needs the p2p halo exchange");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  // Reading rows of the neighbours in place only works for whole rows, one generation at a time
+  if (sd.halo_exchange == shared_exchange
+      && (sd.engine != sweep_engine || sd.decomposition != row_decomposition
+          || sd.halo_depth > 1)) {
+    root_println("Error: the shared halo exchange needs the sweep engine, the row decomposition "
+                 "and a halo_depth of 1");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  // Moving rows between ranks only makes sense for the sweep over the row decomposition
+  if (sd.balance_every > 0
+      && (sd.engine != sweep_engine || sd.decomposition != row_decomposition)) {
+    root_println("Error: load balancing needs the sweep engine and the row decomposition");
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+
+  if (scaling) {
+    // Hashlife runs on a single rank, and a restart has a single generation to start from
+    if (sd.engine == hashlife_engine || !sd.restart_from.empty()) {
+      root_println("Error: the scaling mode needs the sweep engine and a fresh start");
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    if (sd.scaling_repeats == 0) {
+      root_println("Error: the scaling mode needs at least 1 repeat");
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    if (static_cast<usize>(size) > sd.grid_size) {
+      root_println("Error: strong scaling to {} ranks needs a grid_size of at least {}", size,
+                   size);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    status = run_scaling(sd, rank, size);
+
+    MPI_Finalize();
+    return status;
+  }
+
+  if (sd.engine == hashlife_engine) {
+    if (!std::has_single_bit(sd.grid_size)) {
+      root_println("Error: Hashlife needs a grid_size that is a power of two");
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    // Hashlife takes empty space to stay empty, which B0 rules break
+    if ((sd.rule.birth & 1) != 0) {
+      root_println("Error: Hashlife can't run {}, as it gives birth with 0 neighbours",
+                   sd.rule_text);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    if (size > 1) {
+      root_println("Warning: Hashlife runs on rank 0 only, the other {} ranks will idle", size - 1);
+    }
+
+    if (rank == 0) {
+      status = run_hashlife(sd);
+    }
+
+    MPI_Finalize();
+    return status;
+  }
+
+  status = run_decomposed(sd, MPI_COMM_WORLD);
+
+  MPI_Finalize();
+  return status;
+}
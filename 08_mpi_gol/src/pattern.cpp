@@ -0,0 +1,350 @@
+#include "pattern.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+
+// Row `row` of an RLE pattern starts at byte `offset` of the file, at a token boundary
+struct RowStart {
+  u64 row{0};
+  u64 offset{0};
+};
+
+static constexpr u64 no_row = std::numeric_limits<u64>::max();
+
+// Bytes we read before our slice of an RLE file, to get the run length of a `$` at its very start
+static constexpr usize lookback = 32;
+
+static auto is_digit(char ch) -> bool { return ch >= '0' && ch <= '9'; }
+static auto is_space(char ch) -> bool {
+  return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+/*
+ * Where the pattern goes in our block. Rows first_row..last_row - 1 of the pattern fall on our
+ * rows, and `set_run` marks the live cells of a run of columns of one of those rows.
+ */
+struct Placement {
+  const Partition &p;
+  usize at_row, at_col;
+  usize first_row, last_row;
+  u64 pattern_cols;
+  std::vector<u8> &local_bits;
+
+  // Live cells in columns first..last - 1 of pattern row `row`
+  void set_run(u64 row, u64 first, u64 last) const {
+    last = std::min(last, pattern_cols);
+    if (row < first_row || row >= last_row || first >= last) {
+      return;
+    }
+
+    // Clip the run to our columns of the global grid
+    const auto from = std::max(at_col + first, p.col_offset);
+    const auto to = std::min(at_col + last, p.col_offset + p.local_cols);
+
+    const auto local_row_bytes = packed_row_bytes(p.local_cols);
+    auto *out = local_bits.data() + (at_row + row - p.row_offset) * local_row_bytes;
+
+    for (auto c = from; c < to; c++) {
+      const auto local = c - p.col_offset;
+      out[local / 8] = static_cast<u8>(out[local / 8] | (1 << (local % 8)));
+    }
+  }
+};
+
+static auto parse_rle_header(MPI_File file, PatternInfo &info) -> bool {
+  MPI_Offset file_size = 0;
+  MPI_File_get_size(file, &file_size);
+
+  // Comments can be long, so we read blocks until we have seen the size line
+  std::string text;
+  usize line_start = 0;
+  char block[4096];
+
+  while (true) {
+    const auto line_end = text.find('\n', line_start);
+
+    if (line_end == std::string::npos) {
+      const auto offset = static_cast<MPI_Offset>(text.size());
+      if (offset >= file_size) {
+        return false;
+      }
+
+      const auto count = std::min<MPI_Offset>(sizeof(block), file_size - offset);
+      MPI_File_read_at(file, offset, block, static_cast<int>(count), MPI_BYTE, MPI_STATUS_IGNORE);
+      text.append(block, static_cast<usize>(count));
+      continue;
+    }
+
+    const auto line = text.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+
+    if (line.empty() || line[0] == '#' || line[0] == '\r') {
+      continue;
+    }
+
+    // The rule that may follow is ignored, the one of the configuration file wins
+    u64 cols = 0, rows = 0;
+    if (std::sscanf(line.c_str(), " x = %" SCNu64 " , y = %" SCNu64, &cols, &rows) != 2) {
+      return false;
+    }
+
+    info.format = rle_pattern;
+    info.rows = rows;
+    info.cols = cols;
+    info.data_offset = line_start;
+
+    return true;
+  }
+}
+
+/*
+ * Index of the rows of an RLE pattern. Every rank scans a slice of the cells, and the index holds,
+ * for each slice, the row that starts right after its first `$`. With the start of the cells as
+ * row 0, it lets every rank find a small byte range that covers any rows it wants. Also returns
+ * where the pattern ends, at its `!` or at the end of the file.
+ */
+static auto index_rle_rows(MPI_File file, const PatternInfo &info, u64 &data_end, MPI_Comm comm)
+    -> std::vector<RowStart> {
+  int rank = 0, size = 0;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  MPI_Offset file_size = 0;
+  MPI_File_get_size(file, &file_size);
+
+  const auto data_bytes = static_cast<u64>(file_size) - info.data_offset;
+  const auto slice = (data_bytes + static_cast<u64>(size) - 1) / static_cast<u64>(size);
+
+  const auto begin = std::min(info.data_offset + static_cast<u64>(rank) * slice,
+                              static_cast<u64>(file_size));
+  const auto end = std::min(begin + slice, static_cast<u64>(file_size));
+  const auto back = std::min<u64>(lookback, begin - info.data_offset);
+
+  std::vector<char> text(end - begin + back);
+  MPI_File_read_at_all(file, static_cast<MPI_Offset>(begin - back), text.data(),
+                       static_cast<int>(text.size()), MPI_BYTE, MPI_STATUS_IGNORE);
+
+  // Anything after the first `!` of the file is a comment, so find the first one of all slices
+  const auto bang = std::find(text.begin() + static_cast<std::ptrdiff_t>(back), text.end(), '!');
+  u64 local_end = static_cast<u64>(file_size);
+  if (bang != text.end()) {
+    local_end = begin - back + static_cast<u64>(bang - text.begin());
+  }
+  MPI_Allreduce(&local_end, &data_end, 1, MPI_UINT64_T, MPI_MIN, comm);
+
+  // Rows ended in our slice, and where the first row starting in it begins
+  u64 rows_ended = 0;
+  RowStart first{no_row, 0};
+
+  for (usize i = back; i < text.size() && begin - back + i < data_end; i++) {
+    if (text[i] != '$') {
+      continue;
+    }
+
+    /*
+     * The run length is right before the tag, possibly in the bytes before our slice. Writers
+     * should not break a line inside a token, but we skip white space like the decoder does.
+     */
+    u64 run = 0, scale = 1;
+    for (auto j = i; j > 0 && (is_digit(text[j - 1]) || is_space(text[j - 1])); j--) {
+      if (is_digit(text[j - 1])) {
+        run += scale * static_cast<u64>(text[j - 1] - '0');
+        scale *= 10;
+      }
+    }
+    run = (scale == 1) ? 1 : run;
+
+    rows_ended += run;
+    if (first.row == no_row) {
+      first = {rows_ended, begin - back + i + 1};
+    }
+  }
+
+  // Number the rows of the slices. MPI_Exscan leaves the result of rank 0 undefined
+  u64 rows_before = 0;
+  MPI_Exscan(&rows_ended, &rows_before, 1, MPI_UINT64_T, MPI_SUM, comm);
+  if (rank == 0) {
+    rows_before = 0;
+  }
+
+  if (first.row != no_row) {
+    first.row += rows_before;
+  }
+
+  std::vector<RowStart> starts(static_cast<usize>(size));
+  MPI_Allgather(&first, 2, MPI_UINT64_T, starts.data(), 2, MPI_UINT64_T, comm);
+
+  std::vector<RowStart> index{{0, info.data_offset}};
+  for (const auto &start : starts) {
+    if (start.row != no_row) {
+      index.push_back(start);
+    }
+  }
+
+  return index;
+}
+
+static void read_rle(MPI_File file, const PatternInfo &info, const Placement &place,
+                     MPI_Comm comm) {
+  u64 data_end = 0;
+  const auto index = index_rle_rows(file, info, data_end, comm);
+
+  /*
+   * Start at the last row start at or before our first row, and stop at the first one after our
+   * last row: everything before it belongs to earlier rows.
+   */
+  auto from = index.front();
+  u64 to = data_end;
+
+  if (place.first_row < place.last_row) {
+    for (const auto &start : index) {
+      if (start.row <= place.first_row) {
+        from = start;
+      } else if (start.row >= place.last_row) {
+        to = std::min(to, start.offset);
+        break;
+      }
+    }
+  }
+
+  // Ranks without pattern rows still take part in the collective read
+  const auto count = (place.first_row < place.last_row && from.offset < to) ? to - from.offset : 0;
+
+  std::vector<char> text(count);
+  MPI_File_read_at_all(file, static_cast<MPI_Offset>(from.offset), text.data(),
+                       static_cast<int>(count), MPI_BYTE, MPI_STATUS_IGNORE);
+
+  u64 row = from.row;
+  u64 col = 0;
+  u64 run = 0;
+
+  for (const auto ch : text) {
+    if (is_digit(ch)) {
+      run = 10 * run + static_cast<u64>(ch - '0');
+      continue;
+    }
+
+    const auto n = (run == 0) ? 1 : run;
+
+    if (ch == '$') {
+      row += n;
+      col = 0;
+    } else if (ch == 'b' || ch == '.') {
+      col += n;
+    } else if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) {
+      // `o`, or a live state of a multi-state pattern
+      place.set_run(row, col, col + n);
+      col += n;
+    } else {
+      // Line breaks and other white space may go between tokens
+      continue;
+    }
+
+    run = 0;
+
+    if (row >= place.last_row) {
+      break;
+    }
+  }
+}
+
+static void read_bitmap(MPI_File file, const PatternInfo &info, const Placement &place) {
+  const auto row_bytes = packed_row_bytes(info.cols);
+  const auto rows = (place.first_row < place.last_row) ? place.last_row - place.first_row : 0;
+
+  // Our rows of the pattern are in one piece of the file
+  std::vector<u8> bits(rows * row_bytes);
+  MPI_File_read_at_all(file,
+                       static_cast<MPI_Offset>(info.data_offset + place.first_row * row_bytes),
+                       bits.data(), static_cast<int>(bits.size()), MPI_BYTE, MPI_STATUS_IGNORE);
+
+  for (usize r = 0; r < rows; r++) {
+    const auto *in = bits.data() + r * row_bytes;
+
+    for (u64 c = 0; c < info.cols; c++) {
+      if (((in[c / 8] >> (c % 8)) & 1) != 0) {
+        place.set_run(place.first_row + r, c, c + 1);
+      }
+    }
+  }
+}
+
+auto read_pattern_info(const char *path, PatternInfo &info, MPI_Comm comm) -> bool {
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+
+  MPI_File file = MPI_FILE_NULL;
+  if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+    return false;
+  }
+
+  // Rank 0 reads the header and shares it, rather than every rank hitting the file system
+  int ok = 0;
+
+  if (rank == 0) {
+    MPI_Offset file_size = 0;
+    MPI_File_get_size(file, &file_size);
+
+    BitmapHeader header;
+    const BitmapHeader expected;
+
+    if (file_size >= static_cast<MPI_Offset>(sizeof(header))) {
+      MPI_File_read_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0) {
+      info.format = bitmap_pattern;
+      info.rows = header.rows;
+      info.cols = header.cols;
+      info.data_offset = sizeof(header);
+
+      ok = header.row_bytes == packed_row_bytes(header.cols)
+           && static_cast<u64>(file_size) >= sizeof(header) + header.rows * header.row_bytes;
+    } else {
+      ok = parse_rle_header(file, info);
+    }
+  }
+
+  MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+  MPI_Bcast(&info, sizeof(info), MPI_BYTE, 0, comm);
+
+  MPI_File_close(&file);
+
+  return ok != 0;
+}
+
+void read_pattern(const char *path, const SimulationData &sd, const Partition &p,
+                  std::vector<u8> &local_bits, MPI_Comm comm) {
+  local_bits.assign(p.local_rows * packed_row_bytes(p.local_cols), 0);
+
+  PatternInfo info;
+  read_pattern_info(path, info, comm);
+
+  // The rows of the pattern that fall on our rows of the grid
+  const auto first = std::max(p.row_offset, sd.pattern_row);
+  const auto last = std::min(p.row_offset + p.local_rows, sd.pattern_row + info.rows);
+
+  const Placement place{p,
+                        sd.pattern_row,
+                        sd.pattern_col,
+                        (first < last) ? first - sd.pattern_row : 0,
+                        (first < last) ? last - sd.pattern_row : 0,
+                        info.cols,
+                        local_bits};
+
+  MPI_File file = MPI_FILE_NULL;
+  MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+
+  if (info.format == bitmap_pattern) {
+    read_bitmap(file, info, place);
+  } else {
+    read_rle(file, info, place, comm);
+  }
+
+  MPI_File_close(&file);
+}
@@ -0,0 +1,64 @@
+#ifndef MPI_GOL_PATTERN_HPP
+#define MPI_GOL_PATTERN_HPP
+
+/*
+ * Initial patterns read from a file, with every rank reading only the rows it needs.
+ *
+ * Two formats are understood:
+ *
+ *  - RLE, the run length encoded text format of Golly and of the pattern collections. After any
+ *    number of `#` comment lines, a line `x = <cols>, y = <rows>` gives the size of the pattern.
+ *    Then come tokens `<n><tag>`, where n is an optional run length (1 if missing) and the tag is
+ *    `b` for dead cells, `o` for live cells, `$` for the end of a row and `!` for the end of the
+ *    pattern. Cells missing at the end of a row are dead.
+ *  - Bitmaps: a BitmapHeader followed by the rows of the pattern, one bit per cell, packed like the
+ *    snapshots do it (cell c of a row is bit c % 8 of byte c / 8).
+ *
+ * The pattern goes at row pattern_row and column pattern_col of the global grid, and the rest of
+ * the grid is dead.
+ *
+ * The rows of a bitmap are where their size says they are, so each rank reads the rows that fall on
+ * its block directly. The rows of an RLE file have no fixed size, so we first build an index of
+ * where they start: every rank scans an equal slice of the file for the `$` tags, and a prefix sum
+ * over the slices numbers the rows. Each rank then reads and decodes only the bytes between the
+ * index entries around its own rows. Nothing goes through rank 0 but the header.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+struct BitmapHeader {
+  char magic[8]{'G', 'O', 'L', 'B', 'I', 'T', 'S', '1'};
+  u64 rows{0};      // Rows of the pattern
+  u64 cols{0};      // Columns of the pattern
+  u64 row_bytes{0}; // Bytes per row of the pattern
+};
+
+static_assert(sizeof(BitmapHeader) == 32, "BitmapHeader must not have padding");
+
+enum PatternFormat : int { rle_pattern, bitmap_pattern };
+
+struct PatternInfo {
+  PatternFormat format{rle_pattern};
+  u64 rows{0};        // Rows of the pattern
+  u64 cols{0};        // Columns of the pattern
+  u64 data_offset{0}; // Where the cells start in the file, right after the header
+};
+
+/*
+ * Read the header of a pattern file on all ranks of `comm`. Bitmaps are told apart by their magic,
+ * anything else must be RLE. Returns false if the file can't be opened or has no valid header.
+ */
+auto read_pattern_info(const char *path, PatternInfo &info, MPI_Comm comm) -> bool;
+
+/*
+ * Read our block of the grid with the pattern of `path` placed at sd.pattern_row and
+ * sd.pattern_col, packed like pack_block() does. The pattern must fit in the grid.
+ */
+void read_pattern(const char *path, const SimulationData &sd, const Partition &p,
+                  std::vector<u8> &local_bits, MPI_Comm comm);
+
+#endif // MPI_GOL_PATTERN_HPP
@@ -0,0 +1,92 @@
+#ifndef MPI_GOL_PHILOX_HPP
+#define MPI_GOL_PHILOX_HPP
+
+/*
+ * Counter-based random numbers for the initial grid.
+ *
+ * A generator like std::mt19937_64 has a state that each number advances, so the n-th number can
+ * only be had by drawing the n - 1 before it. Seeding it with the rank gives every rank its own
+ * sequence, but then the initial grid depends on how many ranks there are, and every rank draws
+ * its cells one after the other on a single thread.
+ *
+ * Philox (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011) has no state at
+ * all: it is a function that scrambles a 128 bit counter with a 64 bit key, through 10 rounds of
+ * multiplications and xors. Numbering the cells of the whole grid row by row, 128 consecutive cells
+ * get the 128 bits of the block whose counter is their index / 128, keyed by the random seed. Any
+ * rank, and any thread, can then compute any cell on its own, and all decompositions start from the
+ * same grid.
+ */
+
+#include "cells.hpp"
+
+#include <algorithm>
+#include <array>
+
+// Philox4x32-10: the 128 bit counter `ctr` scrambled with the 64 bit key `key`
+inline auto philox4x32(std::array<u32, 4> ctr, std::array<u32, 2> key) -> std::array<u32, 4> {
+  constexpr u64 m0 = 0xD2511F53;
+  constexpr u64 m1 = 0xCD9E8D57;
+  constexpr u32 w0 = 0x9E3779B9;
+  constexpr u32 w1 = 0xBB67AE85;
+
+  for (int round = 0; round < 10; round++) {
+    const auto p0 = m0 * ctr[0];
+    const auto p1 = m1 * ctr[2];
+
+    ctr = {static_cast<u32>(p1 >> 32) ^ ctr[1] ^ key[0], static_cast<u32>(p1),
+           static_cast<u32>(p0 >> 32) ^ ctr[3] ^ key[1], static_cast<u32>(p0)};
+
+    key[0] += w0;
+    key[1] += w1;
+  }
+
+  return ctr;
+}
+
+// The 128 random bits of block `block`. Bit i of the block is bit i % 64 of word i / 64
+inline auto random_block(u64 seed, u64 block) -> std::array<u64, 2> {
+  const auto out = philox4x32({static_cast<u32>(block), static_cast<u32>(block >> 32), 0, 0},
+                              {static_cast<u32>(seed), static_cast<u32>(seed >> 32)});
+
+  return {out[0] | (u64{out[1]} << 32), out[2] | (u64{out[3]} << 32)};
+}
+
+/*
+ * Draw the cells first, ..., first + count - 1 of the grid, numbered row by row from 0, each being
+ * alive or dead with probability 1/2. They come 64 at a time: store(i, bits, n) gets cells
+ * first + i to first + i + n - 1 in the low n bits of `bits`, for i = 0, 64, 128, ... and n = 64
+ * but for the last call. The blocks are a stream of 64 bit words, and when `first` is not a
+ * multiple of 64 each call joins the two words its cells straddle. We compute each block once.
+ */
+template <typename Store> inline void random_words(u64 seed, u64 first, usize count, Store store) {
+  auto cached = ~u64{0};
+  std::array<u64, 2> block{};
+
+  // Word k of the stream, i.e. word k % 2 of block k / 2
+  const auto stream_word = [&](u64 k) {
+    if (k / 2 != cached) {
+      cached = k / 2;
+      block = random_block(seed, cached);
+    }
+    return block[k % 2];
+  };
+
+  const auto shift = first % 64;
+
+  for (usize i = 0; i < count; i += 64) {
+    const auto k = (first + i) / 64;
+    auto bits = stream_word(k) >> shift;
+    if (shift != 0) {
+      bits |= stream_word(k + 1) << (64 - shift);
+    }
+
+    const auto n = std::min<usize>(64, count - i);
+    if (n < 64) {
+      bits &= (u64{1} << n) - 1;
+    }
+
+    store(i, bits, n);
+  }
+}
+
+#endif // MPI_GOL_PHILOX_HPP
@@ -0,0 +1,169 @@
+#ifndef MPI_GOL_RULES_HPP
+#define MPI_GOL_RULES_HPP
+
+/*
+ * Life-like rules.
+ *
+ * The game of life is one of many outer-totalistic rules: the next state of a cell only depends on
+ * its own state and on how many of its 8 neighbours are alive. Such a rule is written in B/S
+ * notation, listing the neighbour counts at which a dead cell is born and those at which a live
+ * cell survives. Conway's game is B3/S23, HighLife is B36/S23 and Day & Night is B3678/S34678.
+ *
+ * We keep a rule as two bit masks, bit n being set if n neighbours give birth (or survival). A rule
+ * policy knows how to evaluate itself on both cell storages of cells.hpp:
+ *
+ *  - next(nsum, cur) for a byte cell with nsum live neighbours,
+ *  - next_word(count, m) for 64 packed cells, whose neighbour counts are given as 4 bit planes.
+ *
+ * FixedRule has its masks as template parameters, so every comparison against a neighbour count
+ * that can't matter is dropped at compile time and the kernels come out as if the rule was written
+ * by hand. The common rules are instantiated this way. Any other rule runs through MaskRule, which
+ * looks the next state up in its masks with a shift. That is branch free too, but costs a variable
+ * shift per cell.
+ */
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+/*
+ * Neighbour counts of 64 cells at once, as 4 bit planes. Bit i of plane k is bit k of the count of
+ * cell i. A count is at most 8, so plane 3 is only set for a count of 8.
+ */
+struct CountPlanes {
+  std::uint64_t c0, c1, c2, c3;
+
+  // Lanes whose count is n
+  constexpr auto equals(unsigned n) const -> std::uint64_t {
+    auto eq = ((n & 1) ? c0 : ~c0) & ((n & 2) ? c1 : ~c1) & ((n & 4) ? c2 : ~c2);
+
+    // For any other count one of the low planes is set, which already rules out a count of 8
+    if (n == 0) {
+      eq &= ~c3;
+    } else if (n == 8) {
+      eq = c3;
+    }
+
+    return eq;
+  }
+};
+
+// A rule whose masks are only known at run time
+struct MaskRule {
+  std::uint32_t birth{0};   // Bit n: a dead cell with n live neighbours is born
+  std::uint32_t survive{0}; // Bit n: a live cell with n live neighbours survives
+
+  auto operator==(const MaskRule &) const -> bool = default;
+
+  // The survival bits sit right above the birth bits, so the state of the cell picks the half
+  inline auto next(std::uint8_t nsum, std::uint8_t cur) const -> std::uint8_t {
+    const auto table = birth | (survive << 9);
+    return static_cast<std::uint8_t>((table >> (nsum + 9 * cur)) & 1);
+  }
+
+  inline auto next_word(const CountPlanes &count, std::uint64_t m) const -> std::uint64_t {
+    std::uint64_t born = 0, kept = 0;
+
+    for (unsigned n = 0; n <= 8; n++) {
+      const auto eq = count.equals(n);
+      born |= eq & (std::uint64_t{0} - ((birth >> n) & 1));
+      kept |= eq & (std::uint64_t{0} - ((survive >> n) & 1));
+    }
+
+    return (born & ~m) | (kept & m);
+  }
+};
+
+template <std::uint32_t Birth, std::uint32_t Survive> struct FixedRule {
+  static constexpr MaskRule masks{Birth, Survive};
+
+  /*
+   * Counts in both masks make the cell alive whatever its state, the others only for dead or for
+   * live cells. For B3/S23 this is (nsum == 3) | ((nsum == 2) & cur).
+   */
+  static constexpr std::uint32_t always = Birth & Survive;
+  static constexpr std::uint32_t only_birth = Birth & ~Survive;
+  static constexpr std::uint32_t only_survive = Survive & ~Birth;
+
+  template <unsigned... N>
+  static inline auto next(std::uint8_t nsum, std::uint8_t cur,
+                          std::integer_sequence<unsigned, N...>) -> std::uint8_t {
+    const auto any = (((always >> N) & 1 ? nsum == N : false) | ...);
+    const auto born = (((only_birth >> N) & 1 ? nsum == N : false) | ...);
+    const auto kept = (((only_survive >> N) & 1 ? nsum == N : false) | ...);
+
+    return static_cast<std::uint8_t>(any | (born & (cur == 0)) | (kept & cur));
+  }
+
+  static inline auto next(std::uint8_t nsum, std::uint8_t cur) -> std::uint8_t {
+    return next(nsum, cur, std::make_integer_sequence<unsigned, 9>{});
+  }
+
+  template <unsigned... N>
+  static inline auto next_word(const CountPlanes &count, std::uint64_t m,
+                               std::integer_sequence<unsigned, N...>) -> std::uint64_t {
+    const auto any = (((always >> N) & 1 ? count.equals(N) : std::uint64_t{0}) | ...);
+    const auto born = (((only_birth >> N) & 1 ? count.equals(N) : std::uint64_t{0}) | ...);
+    const auto kept = (((only_survive >> N) & 1 ? count.equals(N) : std::uint64_t{0}) | ...);
+
+    return any | (born & ~m) | (kept & m);
+  }
+
+  static inline auto next_word(const CountPlanes &count, std::uint64_t m) -> std::uint64_t {
+    return next_word(count, m, std::make_integer_sequence<unsigned, 9>{});
+  }
+};
+
+using ConwayRule = FixedRule<0b1000, 0b1100>;             // B3/S23
+using HighLifeRule = FixedRule<0b1001000, 0b1100>;        // B36/S23
+using DayNightRule = FixedRule<0b111001000, 0b111011000>; // B3678/S34678
+
+/*
+ * Parse a rule in B/S notation, like "B36/S23". Letters may be lower case and either part may be
+ * empty ("B3/S" dies out). Returns false if the string is not a rule.
+ */
+inline auto parse_rule(const char *text, MaskRule &rule) -> bool {
+  const auto digits = [&](char letter, std::uint32_t &mask) {
+    if (std::toupper(static_cast<unsigned char>(*text)) != letter) {
+      return false;
+    }
+    text++;
+
+    mask = 0;
+    while (*text >= '0' && *text <= '8') {
+      mask |= std::uint32_t{1} << (*text - '0');
+      text++;
+    }
+    return true;
+  };
+
+  MaskRule parsed;
+  if (!digits('B', parsed.birth) || *text++ != '/' || !digits('S', parsed.survive) || *text != 0) {
+    return false;
+  }
+
+  rule = parsed;
+  return true;
+}
+
+// The B/S notation of a rule
+inline auto rule_string(const MaskRule &rule) -> std::string {
+  std::string text = "B";
+  for (unsigned n = 0; n <= 8; n++) {
+    if ((rule.birth >> n) & 1) {
+      text += static_cast<char>('0' + n);
+    }
+  }
+
+  text += "/S";
+  for (unsigned n = 0; n <= 8; n++) {
+    if ((rule.survive >> n) & 1) {
+      text += static_cast<char>('0' + n);
+    }
+  }
+
+  return text;
+}
+
+#endif // MPI_GOL_RULES_HPP
@@ -0,0 +1,124 @@
+#include "snapshot.hpp"
+
+#include <cstdio>
+#include <string_view>
+
+auto check_io(int error, const char *what, const char *path, MPI_Comm comm) -> bool {
+  if (error != MPI_SUCCESS) {
+    int rank = 0;
+    MPI_Comm_rank(comm, &rank);
+
+    char message[MPI_MAX_ERROR_STRING];
+    int length = 0;
+    MPI_Error_string(error, message, &length);
+
+    fmt::println(stderr, "Error: rank {} could not {} {}: {}", rank, what, path,
+                 std::string_view(message, static_cast<usize>(length)));
+  }
+
+  int ok = (error == MPI_SUCCESS) ? 1 : 0;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+
+  return ok == 1;
+}
+
+auto make_block_type(usize grid_size, const Partition &p) -> MPI_Datatype {
+  /*
+   * Our block is a subarray of the packed grid. Since our first column is a multiple of 8, it
+   * starts at a whole byte.
+   */
+  const int sizes[2] = {static_cast<int>(grid_size), static_cast<int>(packed_row_bytes(grid_size))};
+  const int subsizes[2] = {static_cast<int>(p.local_rows),
+                           static_cast<int>(packed_row_bytes(p.local_cols))};
+  const int starts[2] = {static_cast<int>(p.row_offset), static_cast<int>(p.col_offset / 8)};
+
+  MPI_Datatype block_type = MPI_DATATYPE_NULL;
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE, &block_type);
+  MPI_Type_commit(&block_type);
+
+  return block_type;
+}
+
+auto open_snapshots(SnapshotWriter &writer, const char *path, usize first_frame,
+                    const SimulationData &sd, const Partition &p, MPI_Comm comm) -> bool {
+  writer.path = path;
+  writer.rank = p.rank;
+  writer.grid_size = sd.grid_size;
+  writer.row_bytes = packed_row_bytes(sd.grid_size);
+  writer.local_bytes = p.local_rows * packed_row_bytes(p.local_cols);
+  writer.frames = first_frame;
+
+  writer.block_type = make_block_type(sd.grid_size, p);
+
+  const auto error
+      = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &writer.file);
+  if (!check_io(error, "open", path, comm)) {
+    if (writer.file != MPI_FILE_NULL) {
+      MPI_File_close(&writer.file);
+    }
+    MPI_Type_free(&writer.block_type);
+    return false;
+  }
+
+  // Drop the frames we are about to write, which a previous run may have left behind
+  const auto size_error = MPI_File_set_size(
+      writer.file, static_cast<MPI_Offset>(first_frame * frame_bytes(sd.grid_size)));
+  if (!check_io(size_error, "truncate", path, comm)) {
+    MPI_File_close(&writer.file);
+    MPI_Type_free(&writer.block_type);
+    return false;
+  }
+
+  return true;
+}
+
+void write_snapshot(SnapshotWriter &writer, usize step, const std::vector<u8> &local_bits) {
+  const auto frame_offset = static_cast<MPI_Offset>(writer.frames * frame_bytes(writer.grid_size));
+
+  // The header is tiny, so rank 0 writes it on its own
+  keep_error(writer.error,
+             MPI_File_set_view(writer.file, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL));
+
+  if (writer.rank == 0) {
+    SnapshotHeader header;
+    header.grid_size = writer.grid_size;
+    header.step = step;
+    header.row_bytes = writer.row_bytes;
+
+    MPI_Status status;
+    const auto result = MPI_File_write_at(writer.file, frame_offset, &header, sizeof(header),
+                                          MPI_BYTE, &status);
+    keep_error(writer.error, write_result(result, status, MPI_BYTE, sizeof(header)));
+  }
+
+  /*
+   * Then all ranks write their blocks together. The view makes the file look like the grid of this
+   * frame with only our block visible, so we write our bytes at offset 0 and MPI-IO scatters them
+   * to the right places. The collective call lets the MPI library merge the pieces of all ranks
+   * into large contiguous writes.
+   */
+  const auto grid_offset = frame_offset + static_cast<MPI_Offset>(sizeof(SnapshotHeader));
+  keep_error(writer.error, MPI_File_set_view(writer.file, grid_offset, MPI_BYTE, writer.block_type,
+                                             "native", MPI_INFO_NULL));
+
+  const auto count = static_cast<int>(writer.local_bytes);
+  MPI_Status status;
+  const auto result
+      = MPI_File_write_at_all(writer.file, 0, local_bits.data(), count, MPI_BYTE, &status);
+  keep_error(writer.error, write_result(result, status, MPI_BYTE, count));
+
+  writer.frames++;
+}
+
+void repartition_snapshots(SnapshotWriter &writer, const Partition &p) {
+  MPI_Type_free(&writer.block_type);
+  writer.block_type = make_block_type(writer.grid_size, p);
+  writer.local_bytes = p.local_rows * packed_row_bytes(p.local_cols);
+}
+
+auto close_snapshots(SnapshotWriter &writer, MPI_Comm comm) -> bool {
+  keep_error(writer.error, MPI_File_close(&writer.file));
+  MPI_Type_free(&writer.block_type);
+
+  return check_io(writer.error, "write", writer.path, comm);
+}
@@ -0,0 +1,148 @@
+#ifndef MPI_GOL_SNAPSHOT_HPP
+#define MPI_GOL_SNAPSHOT_HPP
+
+/*
+ * Binary snapshots of the global grid, written in parallel with MPI-IO.
+ *
+ * All snapshots of a run go to a single file, one frame per dump. A frame is a SnapshotHeader
+ * followed by the grid with one bit per cell: row r takes row_bytes = ceil(grid_size / 8) bytes and
+ * cell c of the row is bit (c % 8) of byte (c / 8). Every frame has the same size, so frame k of
+ * the file starts at byte k * (sizeof(SnapshotHeader) + grid_size * row_bytes).
+ *
+ * Each rank writes the bits of its own block of the grid directly into the frame, so nothing is
+ * funneled through rank 0.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <mpi.h>
+#include <vector>
+
+struct SnapshotHeader {
+  char magic[8]{'G', 'O', 'L', 'S', 'N', 'A', 'P', '1'};
+  u64 grid_size{0}; // Number of rows and columns in the grid
+  u64 step{0};      // Generation stored in this frame
+  u64 row_bytes{0}; // Bytes per row of the grid
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader must not have padding");
+
+struct SnapshotWriter {
+  MPI_File file{MPI_FILE_NULL};
+  const char *path{nullptr};
+  MPI_Datatype block_type{MPI_DATATYPE_NULL}; // Where our bits go inside the grid of a frame
+  int rank{0};
+  usize grid_size{0};
+  usize row_bytes{0};
+  usize local_bytes{0}; // Size of our packed block
+  usize frames{0};      // Frames written so far
+  int error{MPI_SUCCESS}; // First MPI-IO error of this rank, if any
+};
+
+// Bytes taken by one packed row of n cells
+constexpr auto packed_row_bytes(usize n) -> usize { return (n + 7) / 8; }
+
+// Bytes taken by one frame of a grid_size x grid_size grid
+constexpr auto frame_bytes(usize grid_size) -> usize {
+  return sizeof(SnapshotHeader) + grid_size * packed_row_bytes(grid_size);
+}
+
+// Number of frames a run writes before generation `step`
+constexpr auto frames_before(usize step, usize data_every) -> usize {
+  return (step + data_every - 1) / data_every;
+}
+
+/*
+ * Check the MPI-IO error code `error` of every rank of `comm`, from trying to `what` the file
+ * `path`. The ranks that failed print why, and all ranks return false if any of them failed.
+ */
+auto check_io(int error, const char *what, const char *path, MPI_Comm comm) -> bool;
+
+// Keep the first error of a sequence of MPI-IO calls
+inline void keep_error(int &error, int result) {
+  if (error == MPI_SUCCESS) {
+    error = result;
+  }
+}
+
+/*
+ * The result of an MPI-IO write of `count` items of `type`. A short write, e.g. on a full disk,
+ * still returns MPI_SUCCESS and only shows in the count of the status, so we make it an error.
+ */
+inline auto write_result(int result, const MPI_Status &status, MPI_Datatype type, int count)
+    -> int {
+  if (result != MPI_SUCCESS) {
+    return result;
+  }
+
+  int written = 0;
+  MPI_Get_count(&status, type, &written);
+
+  return (written == count) ? MPI_SUCCESS : MPI_ERR_IO;
+}
+
+/*
+ * MPI datatype selecting our block out of a packed grid_size x grid_size grid. The column offset of
+ * every partition must be a multiple of 8 so that each rank owns whole bytes of a packed row.
+ */
+auto make_block_type(usize grid_size, const Partition &p) -> MPI_Datatype;
+
+/*
+ * Open the snapshot file and start writing at frame `first_frame`. Any frames from that point on
+ * are dropped, so a fresh run (first_frame = 0) starts with an empty file and a restarted run
+ * continues the file of the run it restarts. Returns false on all ranks if any rank failed.
+ */
+auto open_snapshots(SnapshotWriter &writer, const char *path, usize first_frame,
+                    const SimulationData &sd, const Partition &p, MPI_Comm comm) -> bool;
+
+/*
+ * Append a frame. `local_bits` holds our block packed with pack_block(). Errors are kept in
+ * writer.error and reported by close_snapshots(), so all ranks keep making the same collective
+ * calls.
+ */
+void write_snapshot(SnapshotWriter &writer, usize step, const std::vector<u8> &local_bits);
+
+// Write the following frames from partition `p`, after the load balancer moved our block
+void repartition_snapshots(SnapshotWriter &writer, const Partition &p);
+
+// Close the file. Returns false on all ranks if any rank failed to write a frame
+auto close_snapshots(SnapshotWriter &writer, MPI_Comm comm) -> bool;
+
+/*
+ * Pack the data cells of a local buffer, one bit per cell. Row r of the buffer has row_words words
+ * and its data cells start at cell first_col.
+ */
+template <typename Cells>
+void pack_block(const typename Cells::word *data, usize row_words, usize first_col,
+                const Partition &p, std::vector<u8> &local_bits) {
+  const auto local_row_bytes = packed_row_bytes(p.local_cols);
+  local_bits.assign(p.local_rows * local_row_bytes, 0);
+
+  for (usize r = 0; r < p.local_rows; r++) {
+    const auto *row = data + (r + 1) * row_words;
+    auto *out = local_bits.data() + r * local_row_bytes;
+
+    for (usize c = 0; c < p.local_cols; c++) {
+      out[c / 8] = static_cast<u8>(out[c / 8] | (Cells::get(row, first_col + c) << (c % 8)));
+    }
+  }
+}
+
+// The inverse of pack_block(): store a packed block into the data cells of a local buffer
+template <typename Cells>
+void unpack_block(const std::vector<u8> &local_bits, usize row_words, usize first_col,
+                  const Partition &p, typename Cells::word *data) {
+  const auto local_row_bytes = packed_row_bytes(p.local_cols);
+
+  for (usize r = 0; r < p.local_rows; r++) {
+    auto *row = data + (r + 1) * row_words;
+    const auto *in = local_bits.data() + r * local_row_bytes;
+
+    for (usize c = 0; c < p.local_cols; c++) {
+      Cells::set(row, first_col + c, static_cast<u8>((in[c / 8] >> (c % 8)) & 1));
+    }
+  }
+}
+
+#endif // MPI_GOL_SNAPSHOT_HPP
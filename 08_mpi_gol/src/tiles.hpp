@@ -0,0 +1,103 @@
+#ifndef MPI_GOL_TILES_HPP
+#define MPI_GOL_TILES_HPP
+
+/*
+ * Activity tracking for mostly quiet grids.
+ *
+ * The local domain is cut into tiles of tile_rows x tile_cols data cells, and for every tile we
+ * remember whether any of its cells changed in the last generation. The next state of a cell only
+ * depends on the 3 x 3 cells around it, so if nothing changed around a cell, it won't change in
+ * the next generation either. A tile only needs to be recomputed if it or one of its 8 neighbour
+ * tiles changed (or, at the edges, if the halo next to it changed).
+ *
+ * Skipping a tile means not writing its cells into the scratch buffer. That buffer holds the state
+ * of the generation before the current one, and for a tile that did not change in the last
+ * generation, that is also the state of the next one. So a skipped tile is already correct.
+ *
+ * Tile i, j covers data rows 1 + i * tile_rows... and data columns j * tile_cols... of the local
+ * buffer. We call a row of tiles a band.
+ */
+
+#include "cells.hpp"
+#include "gol.hpp"
+
+#include <algorithm>
+#include <vector>
+
+struct Tiles {
+  usize tile_rows{0};
+  usize tile_cols{0};
+  usize bands{0};   // Tiles down the local domain
+  usize columns{0}; // Tiles across the local domain
+  bool wrap{false}; // Whether the first and last columns of tiles are neighbours
+
+  std::vector<u8> changed;      // Tiles that changed in the last generation
+  std::vector<u8> next_changed; // Tiles that change in the generation we are computing
+};
+
+/*
+ * With the row decomposition a rank has whole periodic rows, so the first and last columns of
+ * tiles are neighbours. With 2D blocks they are next to the halo columns instead.
+ */
+inline auto make_tiles(const Partition &p, usize tile_rows, usize tile_cols, bool wrap) -> Tiles {
+  Tiles tiles;
+  tiles.tile_rows = tile_rows;
+  tiles.tile_cols = tile_cols;
+  tiles.bands = (p.local_rows + tile_rows - 1) / tile_rows;
+  tiles.columns = (p.local_cols + tile_cols - 1) / tile_cols;
+  tiles.wrap = wrap;
+
+  // Nothing is known about the first generation, so everything counts as changed
+  tiles.changed.assign(tiles.bands * tiles.columns, 1);
+  tiles.next_changed.assign(tiles.bands * tiles.columns, 0);
+
+  return tiles;
+}
+
+inline auto band_of(const Tiles &tiles, usize r) -> usize { return (r - 1) / tiles.tile_rows; }
+
+inline auto column_of(const Tiles &tiles, usize c) -> usize { return c / tiles.tile_cols; }
+
+// Whether any tile in bands i0..i1 and columns j0..j1 (inclusive) changed in the last generation
+inline auto any_changed(const Tiles &tiles, usize i0, usize i1, usize j0, usize j1) -> bool {
+  for (usize i = i0; i <= i1; i++) {
+    for (usize j = j0; j <= j1; j++) {
+      if (tiles.changed[i * tiles.columns + j] != 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Whether tile i, j or one of its neighbour tiles changed in the last generation
+inline auto near_change(const Tiles &tiles, usize i, usize j) -> bool {
+  const auto i0 = (i == 0) ? 0 : i - 1;
+  const auto i1 = std::min(i + 1, tiles.bands - 1);
+  const auto j0 = (j == 0) ? 0 : j - 1;
+  const auto j1 = std::min(j + 1, tiles.columns - 1);
+
+  if (any_changed(tiles, i0, i1, j0, j1)) {
+    return true;
+  }
+
+  // The tiles across the periodic boundary of the row
+  if (tiles.wrap && tiles.columns > 2) {
+    if (j == 0) {
+      return any_changed(tiles, i0, i1, tiles.columns - 1, tiles.columns - 1);
+    }
+    if (j == tiles.columns - 1) {
+      return any_changed(tiles, i0, i1, 0, 0);
+    }
+  }
+
+  return false;
+}
+
+// Move on to the next generation
+inline void advance_tiles(Tiles &tiles) {
+  std::swap(tiles.changed, tiles.next_changed);
+  std::fill(tiles.next_changed.begin(), tiles.next_changed.end(), u8{0});
+}
+
+#endif // MPI_GOL_TILES_HPP
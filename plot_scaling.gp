@@ -9,4 +9,14 @@ plot "openmp_pi_scaling.dat" using 1:3 with linespoints title "std::vector", \
      "openmp_pi_critical_scaling.dat" using 1:3 with linespoints title "omp critical", \
      "openmp_pi_parallel_for_scaling.dat" using 1:3 with linespoints title "parallel for reduction",
 
-pause -1 "Press Enter to continue"
\ No newline at end of file
+pause -1 "Press Enter to continue"
+
+set title "MPI Game of Life speedups"
+
+set xlabel "Number of ranks"
+set ylabel "Speedup"
+
+plot "mpi_gol_strong_scaling.dat" using 1:3 with linespoints title "strong scaling", \
+     "mpi_gol_weak_scaling.dat" using 1:3 with linespoints title "weak scaling (scaled speedup)",
+
+pause -1 "Press Enter to continue"